@@ -17,6 +17,7 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <sndfile.h>
 
 extern DLLEXPORT int    Sndfile_Init(Tcl_Interp * interp);
@@ -29,6 +30,107 @@ extern DLLEXPORT int    Sndfile_Init(Tcl_Interp * interp);
 }
 #endif
 
+/*
+ * Sample types carried by a sample buffer.  The order matches the
+ * read_* and write_* subcommands.
+ */
+enum SndSampleType {
+  SND_TYPE_SHORT,
+  SND_TYPE_INT,
+  SND_TYPE_FLOAT,
+  SND_TYPE_DOUBLE,
+  SND_TYPE_COUNT
+};
+
+static const char *sndTypeNames[] = {
+  "short", "int", "float", "double", 0
+};
+
+static const int sndTypeSizes[] = {
+  sizeof(short), sizeof(int), sizeof(float), sizeof(double)
+};
+
+#define SND_ALIGN 64
+
+/*
+ * Frames per block for commands that work on whole files
+ */
+#define SND_BLOCK_FRAMES 8192
+
+/*
+ * Reference counted sample payload.  The Tcl_Obj type "sndbuffer" points
+ * to one of these, so duplicating the Tcl_Obj or handing it back to
+ * write_* never copies the samples.
+ */
+typedef struct SndBuffer SndBuffer;
+
+struct SndBuffer {
+  int refCount;            /* Guarded by myMutex, buffers cross threads */
+  int type;                /* One of enum SndSampleType */
+  int channels;
+  sf_count_t capacity;     /* Number of samples allocated */
+  sf_count_t items;        /* Number of valid samples */
+  void *data;              /* SND_ALIGN aligned, follows the struct */
+  size_t size;             /* Bytes charged to the budget */
+  int sizeClass;           /* Free list it goes back to, -1 for none */
+  SndBuffer *next;         /* Link on the free list */
+};
+
+/*
+ * Encoder and library settings passed to sf_command().  They can be
+ * given when the handle is opened or changed later by HANDLE configure.
+ */
+static const char *sndConfigStrs[] = {
+  "-compressionlevel",
+  "-vbrquality",
+  "-autoheader",
+  "-normfloat",
+  "-normdouble",
+  "-clipping",
+  0
+};
+
+enum SndConfigEnum {
+  SND_CONFIG_COMPRESSION,
+  SND_CONFIG_VBRQUALITY,
+  SND_CONFIG_AUTOHEADER,
+  SND_CONFIG_NORMFLOAT,
+  SND_CONFIG_NORMDOUBLE,
+  SND_CONFIG_CLIPPING,
+};
+
+typedef struct SndConfig SndConfig;
+
+struct SndConfig {
+  double compression;      /* < 0 means library default */
+  double vbrquality;       /* < 0 means library default */
+  int autoheader;
+  int normfloat;
+  int normdouble;
+  int clipping;
+  int mask;                /* Bit per option given by the user */
+};
+
+/*
+ * Growable memory target for WRITE handles opened with -memory.  Bytes
+ * before "base" were already returned by HANDLE drain and are gone.
+ */
+typedef struct SndMemFile SndMemFile;
+
+struct SndMemFile {
+  unsigned char *data;     /* Bytes from base to length */
+  sf_count_t allocated;
+  sf_count_t base;
+  sf_count_t length;       /* Logical file length */
+  sf_count_t position;
+};
+
+typedef struct SndFollowFile SndFollowFile;
+
+typedef struct SndParallel SndParallel;
+
+typedef struct SndAsync SndAsync;
+
 typedef struct SndFileData SndFileData;
 
 struct SndFileData {
@@ -38,982 +140,7570 @@ struct SndFileData {
   SF_INFO sfinfo;
   int buffersize;
   int buff_init;
-  short *short_block;
-  int *int_block;
-  float *float_block;
-  double *double_block;
+  SndBuffer *blocks[SND_TYPE_COUNT];
+  SndConfig config;
+
+  /*
+   * Tail-follow mode for files that are still being recorded
+   */
+  int follow;
+  int pollinterval;        /* Milliseconds between checks */
+  int followtimeout;       /* Milliseconds read_* may wait for new data */
+  Tcl_Obj *pathObj;        /* Translated file name, to stat and reopen */
+  Tcl_WideInt filesize;
+  Tcl_Obj *availableScript;
+  Tcl_TimerToken followTimer;
+  SndFollowFile *followfile;
+  int followwaiting;       /* read_* runs the event loop for new frames */
+
+  SndMemFile *memfile;     /* Not NULL for -memory handles */
+  SndParallel *parallel;   /* Not NULL for -parallel handles */
+  SndAsync *async;         /* Not NULL while onchunk or onwritable runs */
+
+  /*
+   * -dither for write_float and write_double to integer encodings
+   */
+  int dither;
+  int ditherbits;          /* Bits of the encoding, 0 to leave it to libsndfile */
+  double *ditherstate;     /* Two past errors per channel for -dither shaped */
+  Tcl_WideUInt dithercount; /* Samples dithered so far */
+  int *ditherpending;      /* Dithered samples of a frame that is not complete */
+  int npending;
 };
 
 TCL_DECLARE_MUTEX(myMutex);
 
 
-static int SndObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
-  SndFileData *pSnd = (SndFileData *) cd;
-  int choice;
-  int rc = TCL_OK;
+/*
+ * Buffer memory
+ *
+ * Every SndBuffer comes from a pool of power of two size classes, from
+ * 1 KiB to 1 GiB, with one free list per class; bigger ones are malloc'ed
+ * as they are.  "used" is the class size of all live buffers, and that is
+ * what sndfile::configure -maxbufferbytes limits.  Freed buffers stay on
+ * their list while the lists hold less than SND_POOL_KEEP bytes and, with
+ * a limit, while used plus pooled bytes stay within it.
+ */
+#define SND_POOL_MIN_SHIFT 10
+#define SND_POOL_CLASSES 21
+#define SND_POOL_KEEP ((Tcl_WideInt) 64 << 20)
 
-  static const char *SND_strs[] = {
-    "buffersize",
-    "read_short",
-    "read_int",
-    "read_float",
-    "read_double",
-    "write_short",
-    "write_int",
-    "write_float",
-    "write_double",
-    "seek",
-    "get_string",
-    "set_string",
-    "close", 
-    0
-  };
+static const char *sndOnLimitNames[] = {
+  "error", "shrink", 0
+};
 
-  enum SND_enum {
-    SND_BUFFERSIZE,
-    SND_READ_SHORT,
-    SND_READ_INT,
-    SND_READ_FLOAT,
-    SND_READ_DOUBLE,
-    SND_WRITE_SHORT,
-    SND_WRITE_INT,
-    SND_WRITE_FLOAT,
-    SND_WRITE_DOUBLE,
-    SND_SEEK,
-    SND_GET_STRING,
-    SND_SET_STRING,
-    SND_CLOSE,
-  };
+enum SndOnLimit {
+  SND_ONLIMIT_ERROR,
+  SND_ONLIMIT_SHRINK
+};
 
-  if( objc < 2 ){
-    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
-    return TCL_ERROR;
+static const char *sndMemoryStrs[] = {
+  "-maxbufferbytes",
+  "-defaultbufferframes",
+  "-onlimit",
+  0
+};
+
+enum SndMemoryEnum {
+  SND_MEMORY_MAXBYTES,
+  SND_MEMORY_DEFAULTFRAMES,
+  SND_MEMORY_ONLIMIT
+};
+
+typedef struct SndMemory SndMemory;
+
+struct SndMemory {
+  Tcl_WideInt maxbytes;    /* 0 for no limit */
+  int defaultframes;       /* 0 for one second */
+  int onlimit;             /* One of enum SndOnLimit */
+  Tcl_WideInt used;
+  Tcl_WideInt peak;
+  Tcl_WideInt pooled;      /* Bytes on the free lists */
+  Tcl_WideInt buffers;     /* Live buffers */
+  int handles;             /* Open HANDLEs */
+  Tcl_WideInt allocs;
+  Tcl_WideInt reuses;      /* Allocations served by a free list */
+  Tcl_WideInt shrinks;     /* Blocks made smaller to fit the limit */
+  Tcl_WideInt failures;    /* Allocations refused by the limit */
+  SndBuffer *freelist[SND_POOL_CLASSES];
+};
+
+static SndMemory sndMemory;    /* Guarded by myMutex */
+static int sndPoolExitHandler = 0;
+
+/*
+ * Bytes to allocate for "capacity" samples of "type", rounded up to the
+ * size class.
+ */
+static size_t SndPoolSize(int type, sf_count_t capacity, int *sizeClass){
+  size_t nbytes = sizeof(SndBuffer) + SND_ALIGN + (size_t) capacity * sndTypeSizes[type];
+  int i;
+
+  for(i = 0; i < SND_POOL_CLASSES; i++) {
+    if(((size_t) 1 << (i + SND_POOL_MIN_SHIFT)) >= nbytes) {
+      *sizeClass = i;
+      return (size_t) 1 << (i + SND_POOL_MIN_SHIFT);
+    }
   }
 
-  if( Tcl_GetIndexFromObj(interp, objv[1], SND_strs, "option", 0, &choice) ){
-    return TCL_ERROR;
+  *sizeClass = -1;
+  return nbytes;
+}
+
+/*
+ * Free pooled buffers until the free lists hold at most "keep" bytes,
+ * largest classes first.
+ */
+static void SndPoolTrim(Tcl_WideInt keep){
+  SndBuffer *list = NULL, *buf;
+  int i;
+
+  Tcl_MutexLock(&myMutex);
+  for(i = SND_POOL_CLASSES - 1; i >= 0 && sndMemory.pooled > keep; i--) {
+    while(sndMemory.freelist[i] && sndMemory.pooled > keep) {
+      buf = sndMemory.freelist[i];
+      sndMemory.freelist[i] = buf->next;
+      sndMemory.pooled -= buf->size;
+      buf->next = list;
+      list = buf;
+    }
   }
+  Tcl_MutexUnlock(&myMutex);
 
-  switch( (enum SND_enum)choice ){
+  while(list) {
+    buf = list;
+    list = buf->next;
+    free(buf);
+  }
+}
 
-    case SND_BUFFERSIZE: {
-      int buffersize = 0;
+static void SndPoolExitHandler(ClientData clientData){
+  SndPoolTrim(0);
+}
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv, "size");
-        return TCL_ERROR;
-      }
+/*
+ * Samples per block when the script did not give -buffersize: one second
+ * of audio, or -defaultbufferframes frames.
+ */
+static int SndDefaultBufferSize(const SF_INFO *sfinfo){
+  int frames;
 
-      if(Tcl_GetIntFromObj(interp, objv[2], &buffersize) != TCL_OK) {
-         return TCL_ERROR;
-      }
+  Tcl_MutexLock(&myMutex);
+  frames = sndMemory.defaultframes > 0 ? sndMemory.defaultframes : sfinfo->samplerate;
+  Tcl_MutexUnlock(&myMutex);
 
-      if(buffersize <= 0) {
-         Tcl_AppendResult(interp, "Error: buffersize needs > 0", (char*)0);
-         return TCL_ERROR;
-      }
+  return frames * sfinfo->channels;
+}
 
-      Tcl_MutexLock(&myMutex);
-      if(pSnd->buff_init == 0) {
-        pSnd->buffersize = buffersize;
-        pSnd->buff_init = 1;
-      }
-      Tcl_MutexUnlock(&myMutex);
-      break;
-    }
+/*
+ * Message for a buffer that could not be allocated
+ */
+static const char *SndAllocError(void){
+  Tcl_WideInt maxbytes;
 
-    case SND_READ_SHORT: {
-      Tcl_Obj *return_obj = NULL;
-      long read_count = 0;
-      long second_count = pSnd->sfinfo.samplerate * pSnd->sfinfo.channels;
+  Tcl_MutexLock(&myMutex);
+  maxbytes = sndMemory.maxbytes;
+  Tcl_MutexUnlock(&myMutex);
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+  return maxbytes > 0 ? "Error: buffer memory budget exceeded" : "malloc failed";
+}
 
-      // It is still 0 -> setup the value
-      if(pSnd->buffersize == 0) {
-         Tcl_MutexLock(&myMutex);
-         pSnd->buffersize = second_count;
-         pSnd->buff_init = 1;
-         Tcl_MutexUnlock(&myMutex);
-      }
+/*
+ * The same without "Error: ", for the per file errors of batch commands
+ */
+static const char *SndAllocReason(void){
+  const char *zMsg = SndAllocError();
 
-      if(pSnd->short_block == NULL) {
-         pSnd->short_block = (short *) malloc (pSnd->buffersize * sizeof(short));
-         if( pSnd->short_block == 0 ){
-           Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
-           return TCL_ERROR;
-         }
-      }
+  return strncmp(zMsg, "Error: ", 7) == 0 ? zMsg + 7 : zMsg;
+}
 
-      read_count = sf_read_short(pSnd->sndfile, pSnd->short_block, pSnd->buffersize);
 
-      if(read_count <= 0) {
-         return TCL_ERROR;
-      } else {
-         return_obj = Tcl_NewByteArrayObj((unsigned char *) pSnd->short_block, read_count * sizeof(short));
-         Tcl_SetObjResult(interp, return_obj);
+/*
+ * Sample buffer helpers
+ */
+
+/*
+ * Allocate a buffer for "capacity" samples.  When that does not fit the
+ * limit and -onlimit is shrink, the capacity is halved, in whole frames,
+ * down to "minimum" samples.  Empty buffers are never refused.
+ */
+static SndBuffer *SndBufferAllocFit(int type, int channels, sf_count_t capacity,
+                                    sf_count_t minimum){
+  SndBuffer *buf = NULL;
+  Tcl_WideInt limit, keep = -1;
+  size_t size;
+  int sizeClass;
+  char *mem;
+
+  Tcl_MutexLock(&myMutex);
+  size = SndPoolSize(type, capacity, &sizeClass);
+  limit = sndMemory.maxbytes;
+
+  if(limit > 0 && capacity > 0 && sndMemory.used + (Tcl_WideInt) size > limit) {
+    if(sndMemory.onlimit == SND_ONLIMIT_SHRINK && minimum < capacity) {
+      while(capacity > minimum && sndMemory.used + (Tcl_WideInt) size > limit) {
+        capacity /= 2;
+        if(channels > 0) {
+          capacity -= capacity % channels;
+        }
+        if(capacity < minimum) {
+          capacity = minimum;
+        }
+        size = SndPoolSize(type, capacity, &sizeClass);
       }
+    }
 
-      break;
+    if(sndMemory.used + (Tcl_WideInt) size > limit) {
+      sndMemory.failures++;
+      Tcl_MutexUnlock(&myMutex);
+      return NULL;
     }
+    sndMemory.shrinks++;
+  }
 
-    case SND_READ_INT: {
-      Tcl_Obj *return_obj = NULL;
-      long read_count = 0;
-      long second_count = pSnd->sfinfo.samplerate * pSnd->sfinfo.channels;
+  if(sizeClass >= 0 && sndMemory.freelist[sizeClass]) {
+    buf = sndMemory.freelist[sizeClass];
+    sndMemory.freelist[sizeClass] = buf->next;
+    sndMemory.pooled -= size;
+    sndMemory.reuses++;
+  }
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+  /* Reserve the bytes now, malloc outside of the lock */
+  sndMemory.used += size;
+  if(sndMemory.used > sndMemory.peak) {
+    sndMemory.peak = sndMemory.used;
+  }
+  sndMemory.buffers++;
+  sndMemory.allocs++;
+  if(limit > 0 && sndMemory.used + sndMemory.pooled > limit) {
+    keep = limit > sndMemory.used ? limit - sndMemory.used : 0;
+  }
+  Tcl_MutexUnlock(&myMutex);
 
-      // It is still 0 -> setup the value
-      if(pSnd->buffersize == 0) {
-         Tcl_MutexLock(&myMutex);
-         pSnd->buffersize = second_count;
-         pSnd->buff_init = 1;
-         Tcl_MutexUnlock(&myMutex);
-      }
+  if(keep >= 0) {
+    SndPoolTrim(keep);
+  }
 
-      if(pSnd->int_block == NULL) {
-         pSnd->int_block = (int *) malloc (pSnd->buffersize * sizeof(int));
-         if( pSnd->int_block == 0 ){
-           Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
-           return TCL_ERROR;
-         }
-      }
+  if(buf == NULL) {
+    buf = (SndBuffer *) malloc(size);
+    if(buf == NULL) {
+      Tcl_MutexLock(&myMutex);
+      sndMemory.used -= size;
+      sndMemory.buffers--;
+      Tcl_MutexUnlock(&myMutex);
+      return NULL;
+    }
+  }
 
-      read_count = sf_read_int(pSnd->sndfile, pSnd->int_block, pSnd->buffersize);
+  mem = (char *) buf;
+  buf->refCount = 1;
+  buf->type = type;
+  buf->channels = channels;
+  buf->capacity = capacity;
+  buf->items = 0;
+  buf->size = size;
+  buf->sizeClass = sizeClass;
+  buf->next = NULL;
+  mem += sizeof(SndBuffer);
+  buf->data = mem + ((SND_ALIGN - ((size_t) mem % SND_ALIGN)) % SND_ALIGN);
+
+  return buf;
+}
 
-      if(read_count <= 0) {
-         return TCL_ERROR;
-      } else {
-         return_obj = Tcl_NewByteArrayObj((unsigned char *) pSnd->int_block, read_count * sizeof(int));
-         Tcl_SetObjResult(interp, return_obj);
-      }
+static SndBuffer *SndBufferAlloc(int type, int channels, sf_count_t capacity){
+  return SndBufferAllocFit(type, channels, capacity, capacity);
+}
 
-      break;
-    }
+/*
+ * Count "nbytes" of working memory that is not a sample buffer, like FFT
+ * tables, in "used".  Returns 0 when that does not fit the limit.
+ */
+static int SndMemoryCharge(Tcl_WideInt nbytes){
+  Tcl_WideInt limit, keep = -1;
+
+  Tcl_MutexLock(&myMutex);
+  limit = sndMemory.maxbytes;
+  if(limit > 0 && nbytes > 0 && sndMemory.used + nbytes > limit) {
+    sndMemory.failures++;
+    Tcl_MutexUnlock(&myMutex);
+    return 0;
+  }
 
-    case SND_READ_FLOAT: {
-      Tcl_Obj *return_obj = NULL;
-      long read_count = 0;
-      long second_count = pSnd->sfinfo.samplerate * pSnd->sfinfo.channels;
+  sndMemory.used += nbytes;
+  if(sndMemory.used > sndMemory.peak) {
+    sndMemory.peak = sndMemory.used;
+  }
+  if(limit > 0 && sndMemory.used + sndMemory.pooled > limit) {
+    keep = limit > sndMemory.used ? limit - sndMemory.used : 0;
+  }
+  Tcl_MutexUnlock(&myMutex);
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+  if(keep >= 0) {
+    SndPoolTrim(keep);
+  }
 
-      // It is still 0 -> setup the value
-      if(pSnd->buffersize == 0) {
-         Tcl_MutexLock(&myMutex);
-         pSnd->buffersize = second_count;
-         pSnd->buff_init = 1;
-         Tcl_MutexUnlock(&myMutex);
-      }
+  return 1;
+}
 
-      if(pSnd->float_block == NULL) {
-         pSnd->float_block = (float *) malloc (pSnd->buffersize * sizeof(float));
-         if( pSnd->float_block == 0 ){
-           Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
-           return TCL_ERROR;
-         }
-      }
+static void SndMemoryUncharge(Tcl_WideInt nbytes){
+  Tcl_MutexLock(&myMutex);
+  sndMemory.used -= nbytes;
+  Tcl_MutexUnlock(&myMutex);
+}
 
-      read_count = sf_read_float(pSnd->sndfile, pSnd->float_block, pSnd->buffersize);
+static void SndBufferRetain(SndBuffer *buf){
+  Tcl_MutexLock(&myMutex);
+  buf->refCount++;
+  Tcl_MutexUnlock(&myMutex);
+}
 
-      if(read_count <= 0) {
-         return TCL_ERROR;
-      } else {
-         return_obj = Tcl_NewByteArrayObj((unsigned char *) pSnd->float_block, read_count * sizeof(float));
-         Tcl_SetObjResult(interp, return_obj);
-      }
+/*
+ * True when somebody besides the caller still holds the buffer
+ */
+static int SndBufferShared(SndBuffer *buf){
+  int shared;
 
-      break;
-    }
+  Tcl_MutexLock(&myMutex);
+  shared = buf->refCount > 1;
+  Tcl_MutexUnlock(&myMutex);
 
-    case SND_READ_DOUBLE: {
-      Tcl_Obj *return_obj = NULL;
-      long read_count = 0;
-      long second_count = pSnd->sfinfo.samplerate * pSnd->sfinfo.channels;
+  return shared;
+}
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
-        return TCL_ERROR;
-      }
+static void SndBufferRelease(SndBuffer *buf){
+  Tcl_WideInt keep;
 
-      // It is still 0 -> setup the value
-      if(pSnd->buffersize == 0) {
-         Tcl_MutexLock(&myMutex);
-         pSnd->buffersize = second_count;
-         pSnd->buff_init = 1;
-         Tcl_MutexUnlock(&myMutex);
-      }
+  if(buf == NULL) {
+    return;
+  }
 
-      if(pSnd->double_block == NULL) {
-         pSnd->double_block = (double *) malloc (pSnd->buffersize * sizeof(double));
-         if( pSnd->double_block == 0 ){
-           Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
-           return TCL_ERROR;
-         }
-      }
+  Tcl_MutexLock(&myMutex);
+  if(--buf->refCount > 0) {
+    Tcl_MutexUnlock(&myMutex);
+    return;
+  }
 
-      read_count = sf_read_double(pSnd->sndfile, pSnd->double_block, pSnd->buffersize);
+  sndMemory.used -= buf->size;
+  sndMemory.buffers--;
 
-      if(read_count <= 0) {
-         return TCL_ERROR;
-      } else {
-         return_obj = Tcl_NewByteArrayObj((unsigned char *) pSnd->double_block, read_count * sizeof(double));
-         Tcl_SetObjResult(interp, return_obj);
-      }
+  keep = SND_POOL_KEEP;
+  if(sndMemory.maxbytes > 0 && sndMemory.maxbytes - sndMemory.used < keep) {
+    keep = sndMemory.maxbytes - sndMemory.used;
+  }
 
-      break;
-    }
+  if(buf->sizeClass >= 0 && sndMemory.pooled + (Tcl_WideInt) buf->size <= keep) {
+    buf->next = sndMemory.freelist[buf->sizeClass];
+    sndMemory.freelist[buf->sizeClass] = buf;
+    sndMemory.pooled += buf->size;
+    buf = NULL;
+  }
+  Tcl_MutexUnlock(&myMutex);
 
-    case SND_WRITE_SHORT: {
-      Tcl_Obj *return_obj = NULL;
-      unsigned char *zData = NULL;
-      Tcl_Size len;
-      sf_count_t count;
+  free(buf);
+}
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "byte_array"
-        );
-        return TCL_ERROR;
-      }
+static void FreeSndBufferInternalRep(Tcl_Obj *objPtr);
+static void DupSndBufferInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+static void UpdateStringOfSndBuffer(Tcl_Obj *objPtr);
 
-      zData = Tcl_GetByteArrayFromObj(objv[2], &len);
-      if( !zData || len < 1 ){
-          return TCL_ERROR;
-      }
+/*
+ * The string representation is the same as the one of a byte array with
+ * the raw sample bytes, so scripts that treat the value as a byte array
+ * keep working.  It is only generated when somebody asks for it.
+ */
+static const Tcl_ObjType sndBufferType = {
+  "sndbuffer",
+  FreeSndBufferInternalRep,
+  DupSndBufferInternalRep,
+  UpdateStringOfSndBuffer,
+  NULL
+};
 
-      count = sf_write_short(pSnd->sndfile, (short *) zData, len/sizeof(short));
-      return_obj = Tcl_NewIntObj((sf_count_t) count);
-      Tcl_SetObjResult(interp, return_obj);
+#define SndBufferGetIntRep(objPtr) \
+  ((SndBuffer *) (objPtr)->internalRep.twoPtrValue.ptr1)
 
-      break;
-    }
+static void FreeSndBufferInternalRep(Tcl_Obj *objPtr){
+  SndBufferRelease(SndBufferGetIntRep(objPtr));
+  objPtr->internalRep.twoPtrValue.ptr1 = NULL;
+  objPtr->typePtr = NULL;
+}
 
-    case SND_WRITE_INT: {
-      Tcl_Obj *return_obj = NULL;
-      unsigned char *zData = NULL;
-      Tcl_Size len;
-      sf_count_t count;
+static void DupSndBufferInternalRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr){
+  SndBuffer *buf = SndBufferGetIntRep(srcPtr);
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "byte_array"
-        );
-        return TCL_ERROR;
-      }
+  SndBufferRetain(buf);
+  dupPtr->internalRep.twoPtrValue.ptr1 = buf;
+  dupPtr->internalRep.twoPtrValue.ptr2 = NULL;
+  dupPtr->typePtr = &sndBufferType;
+}
 
-      zData = Tcl_GetByteArrayFromObj(objv[2], &len);
-      if( !zData || len < 1 ){
-          return TCL_ERROR;
-      }
+static void UpdateStringOfSndBuffer(Tcl_Obj *objPtr){
+  SndBuffer *buf = SndBufferGetIntRep(objPtr);
+  const unsigned char *src = (const unsigned char *) buf->data;
+  size_t nbytes = (size_t) buf->items * sndTypeSizes[buf->type];
+  size_t i, size = 0;
+  char *dst;
 
-      count = sf_write_int(pSnd->sndfile, (int *) zData, len/sizeof(int));
-      return_obj = Tcl_NewIntObj((sf_count_t) count);
-      Tcl_SetObjResult(interp, return_obj);
+  /* Same encoding as a byte array: 0x00 and 0x80-0xFF take two bytes */
+  for(i = 0; i < nbytes; i++) {
+    size += (src[i] == 0 || src[i] > 0x7F) ? 2 : 1;
+  }
 
-      break;
-    }
+  dst = Tcl_Alloc(size + 1);
+  objPtr->bytes = dst;
+  objPtr->length = size;
 
-    case SND_WRITE_FLOAT: {
+  for(i = 0; i < nbytes; i++) {
+    if(src[i] == 0 || src[i] > 0x7F) {
+      *dst++ = (char) (0xC0 | (src[i] >> 6));
+      *dst++ = (char) (0x80 | (src[i] & 0x3F));
+    } else {
+      *dst++ = (char) src[i];
+    }
+  }
+  *dst = '\0';
+}
+
+static Tcl_Obj *SndBufferNewObj(SndBuffer *buf){
+  Tcl_Obj *objPtr = Tcl_NewObj();
+
+  Tcl_InvalidateStringRep(objPtr);
+  SndBufferRetain(buf);
+  objPtr->internalRep.twoPtrValue.ptr1 = buf;
+  objPtr->internalRep.twoPtrValue.ptr2 = NULL;
+  objPtr->typePtr = &sndBufferType;
+
+  return objPtr;
+}
+
+/*
+ * Return the sample buffer behind a Tcl_Obj, or NULL when the value is
+ * not (or no longer) a "sndbuffer".
+ */
+static SndBuffer *SndBufferFromObj(Tcl_Obj *objPtr){
+  if(objPtr->typePtr == &sndBufferType) {
+    return SndBufferGetIntRep(objPtr);
+  }
+
+  return NULL;
+}
+
+/*
+ * Raw sample bytes of a value: a "sndbuffer" is used in place, anything
+ * else is treated as a byte array.
+ */
+static unsigned char *SndGetBytesFromObj(Tcl_Obj *objPtr, Tcl_Size *lenPtr){
+  SndBuffer *buf = SndBufferFromObj(objPtr);
+
+  if(buf) {
+    *lenPtr = (Tcl_Size) (buf->items * sndTypeSizes[buf->type]);
+    return (unsigned char *) buf->data;
+  }
+
+  return Tcl_GetByteArrayFromObj(objPtr, lenPtr);
+}
+
+/*
+ * Get the handle's block for the given sample type.  The block is reused
+ * as long as no Tcl_Obj still refers to it.  With -onlimit shrink it can
+ * hold less than buffersize samples.
+ */
+static SndBuffer *SndGetBlock(SndFileData *pSnd, int type){
+  SndBuffer *buf = pSnd->blocks[type];
+
+  // It is still 0 -> setup the value
+  if(pSnd->buffersize == 0) {
+     int buffersize = SndDefaultBufferSize(&pSnd->sfinfo);
+
+     Tcl_MutexLock(&myMutex);
+     pSnd->buffersize = buffersize;
+     pSnd->buff_init = 1;
+     Tcl_MutexUnlock(&myMutex);
+  }
+
+  if(buf && SndBufferShared(buf)) {
+    SndBufferRelease(buf);
+    buf = NULL;
+  }
+
+  if(buf == NULL) {
+    buf = SndBufferAllocFit(type, pSnd->sfinfo.channels, pSnd->buffersize,
+                            pSnd->sfinfo.channels);
+    pSnd->blocks[type] = buf;
+  }
+
+  return buf;
+}
+
+static void SndFreeBlocks(SndFileData *pSnd){
+  int i;
+
+  for(i = 0; i < SND_TYPE_COUNT; i++) {
+    SndBufferRelease(pSnd->blocks[i]);
+    pSnd->blocks[i] = NULL;
+  }
+}
+
+/*
+ * Virtual I/O for -memory handles
+ */
+
+static sf_count_t SndMemGetFilelen(void *user_data){
+  SndMemFile *mem = (SndMemFile *) user_data;
+
+  return mem->length;
+}
+
+static sf_count_t SndMemSeek(sf_count_t offset, int whence, void *user_data){
+  SndMemFile *mem = (SndMemFile *) user_data;
+  sf_count_t position = offset;
+
+  switch(whence) {
+    case SEEK_CUR:
+      position = mem->position + offset;
+      break;
+    case SEEK_END:
+      position = mem->length + offset;
+      break;
+  }
+
+  if(position < 0) {
+    return -1;
+  }
+
+  mem->position = position;
+  return position;
+}
+
+static sf_count_t SndMemRead(void *ptr, sf_count_t count, void *user_data){
+  SndMemFile *mem = (SndMemFile *) user_data;
+  unsigned char *dst = (unsigned char *) ptr;
+  sf_count_t skip = 0;
+
+  if(mem->position >= mem->length) {
+    return 0;
+  }
+
+  if(count > mem->length - mem->position) {
+    count = mem->length - mem->position;
+  }
+
+  /* Drained bytes read back as zeros */
+  if(mem->position < mem->base) {
+    skip = mem->base - mem->position;
+    if(skip > count) skip = count;
+    memset(dst, 0, skip);
+  }
+
+  if(count > skip) {
+    memcpy(dst + skip, mem->data + (mem->position + skip - mem->base), count - skip);
+  }
+
+  mem->position += count;
+  return count;
+}
+
+static sf_count_t SndMemWrite(const void *ptr, sf_count_t count, void *user_data){
+  SndMemFile *mem = (SndMemFile *) user_data;
+  const unsigned char *src = (const unsigned char *) ptr;
+  sf_count_t start = mem->position;
+  sf_count_t end = mem->position + count;
+  sf_count_t size;
+  unsigned char *data;
+
+  /*
+   * Header updates that land in the drained part are dropped, the bytes
+   * were already sent.
+   */
+  if(start < mem->base) {
+    if(end <= mem->base) {
+      mem->position = end;
+      return count;
+    }
+    src += mem->base - start;
+    start = mem->base;
+  }
+
+  if(end - mem->base > mem->allocated) {
+    size = mem->allocated ? mem->allocated : 65536;
+    while(size < end - mem->base) {
+      size *= 2;
+    }
+
+    /* The bytes kept for drain count in the memory budget */
+    if(!SndMemoryCharge(size - mem->allocated)) {
+      return 0;
+    }
+    data = (unsigned char *) realloc(mem->data, size);
+    if(data == NULL) {
+      SndMemoryUncharge(size - mem->allocated);
+      return 0;
+    }
+    mem->data = data;
+    mem->allocated = size;
+  }
+
+  if(start > mem->length) {
+    memset(mem->data + (mem->length - mem->base), 0, start - mem->length);
+  }
+
+  memcpy(mem->data + (start - mem->base), src, end - start);
+  if(end > mem->length) {
+    mem->length = end;
+  }
+  mem->position = end;
+
+  return count;
+}
+
+static sf_count_t SndMemTell(void *user_data){
+  SndMemFile *mem = (SndMemFile *) user_data;
+
+  return mem->position;
+}
+
+static SF_VIRTUAL_IO sndMemIO = {
+  SndMemGetFilelen,
+  SndMemSeek,
+  SndMemRead,
+  SndMemWrite,
+  SndMemTell
+};
+
+/*
+ * Return the bytes written since the last drain and discard them.
+ */
+static Tcl_Obj *SndMemDrain(SndMemFile *mem){
+  Tcl_Obj *objPtr;
+
+  objPtr = Tcl_NewByteArrayObj(mem->data, (Tcl_Size) (mem->length - mem->base));
+  mem->base = mem->length;
+
+  return objPtr;
+}
+
+static void SndMemFree(SndMemFile *mem){
+  if(mem) {
+    SndMemoryUncharge(mem->allocated);
+    free(mem->data);
+    free(mem);
+  }
+}
+
+/*
+ * File format and encoding names
+ */
+
+typedef struct SndFormatName SndFormatName;
+
+struct SndFormatName {
+  const char *name;
+  int format;
+};
+
+static const SndFormatName sndFileFormats[] = {
+  { "wav", SF_FORMAT_WAV },
+  { "aiff", SF_FORMAT_AIFF },
+  { "au", SF_FORMAT_AU },
+  { "raw", SF_FORMAT_RAW },
+  { "paf", SF_FORMAT_PAF },
+  { "svx", SF_FORMAT_SVX },
+  { "nist", SF_FORMAT_NIST },
+  { "voc", SF_FORMAT_VOC },
+  { "ircam", SF_FORMAT_IRCAM },
+  { "w64", SF_FORMAT_W64 },
+  { "mat4", SF_FORMAT_MAT4 },
+  { "mat5", SF_FORMAT_MAT5 },
+  { "pvf", SF_FORMAT_PVF },
+  { "xi", SF_FORMAT_XI },
+  { "htk", SF_FORMAT_HTK },
+  { "sds", SF_FORMAT_SDS },
+  { "avr", SF_FORMAT_AVR },
+  { "wavex", SF_FORMAT_WAVEX },
+  { "sd2", SF_FORMAT_SD2 },
+  { "flac", SF_FORMAT_FLAC },
+  { "caf", SF_FORMAT_CAF },
+  { "wve", SF_FORMAT_WVE },
+  { "ogg", SF_FORMAT_OGG },
+  { "mpc2k", SF_FORMAT_MPC2K },
+  { "rf64", SF_FORMAT_RF64 },
+  { 0, 0 }
+};
+
+static const SndFormatName sndEncodings[] = {
+  { "pcm_16", SF_FORMAT_PCM_16 },
+  { "pcm_24", SF_FORMAT_PCM_24 },
+  { "pcm_32", SF_FORMAT_PCM_32 },
+  { "pcm_s8", SF_FORMAT_PCM_S8 },
+  { "pcm_u8", SF_FORMAT_PCM_U8 },
+  { "float", SF_FORMAT_FLOAT },
+  { "double", SF_FORMAT_DOUBLE },
+  { "ulaw", SF_FORMAT_ULAW },
+  { "alaw", SF_FORMAT_ALAW },
+  { "ima_adpcm", SF_FORMAT_IMA_ADPCM },
+  { "ms_adpcm", SF_FORMAT_MS_ADPCM },
+  { "gsm610", SF_FORMAT_GSM610 },
+  { "vox_adpcm", SF_FORMAT_VOX_ADPCM },
+  { "g721_32", SF_FORMAT_G721_32 },
+  { "g723_24", SF_FORMAT_G723_24 },
+  { "g723_40", SF_FORMAT_G723_40 },
+  { "dwvw_12", SF_FORMAT_DWVW_12 },
+  { "dwvw_16", SF_FORMAT_DWVW_16 },
+  { "dwvw_24", SF_FORMAT_DWVW_24 },
+  { "dwvw_n", SF_FORMAT_DWVW_N },
+  { "dpcm_8", SF_FORMAT_DPCM_8 },
+  { "dpcm_16", SF_FORMAT_DPCM_16 },
+  { "vorbis", SF_FORMAT_VORBIS },
+  { 0, 0 }
+};
+
+/*
+ * Replace the file format and/or the encoding of *format.  A NULL name
+ * keeps that part of *format.
+ */
+static int SndParseFormat(Tcl_Interp *interp, const char *fileformat,
+                          const char *encoding, int *format){
+  int i;
+
+  if(fileformat) {
+    for(i = 0; sndFileFormats[i].name; i++) {
+      if(strcmp(fileformat, sndFileFormats[i].name)==0) break;
+    }
+
+    if(sndFileFormats[i].name == NULL) {
+      Tcl_AppendResult(interp, "fileformat unknown option", (char*)0);
+      return TCL_ERROR;
+    }
+
+    *format = (*format & ~SF_FORMAT_TYPEMASK) | sndFileFormats[i].format;
+  }
+
+  if(encoding) {
+    for(i = 0; sndEncodings[i].name; i++) {
+      if(strcmp(encoding, sndEncodings[i].name)==0) break;
+    }
+
+    if(sndEncodings[i].name == NULL) {
+      Tcl_AppendResult(interp, "encoding unknown option", (char*)0);
+      return TCL_ERROR;
+    }
+
+    *format = (*format & ~SF_FORMAT_SUBMASK) | sndEncodings[i].format;
+  }
+
+  return TCL_OK;
+}
+
+static const char *SndFileFormatName(int format){
+  int i;
+
+  for(i = 0; sndFileFormats[i].name; i++) {
+    if((format & SF_FORMAT_TYPEMASK) == sndFileFormats[i].format) {
+      return sndFileFormats[i].name;
+    }
+  }
+
+  return "unknown";
+}
+
+static const char *SndEncodingName(int format){
+  int i;
+
+  for(i = 0; sndEncodings[i].name; i++) {
+    if((format & SF_FORMAT_SUBMASK) == sndEncodings[i].format) {
+      return sndEncodings[i].name;
+    }
+  }
+
+  return "unknown";
+}
+
+/*
+ * Settings helpers
+ */
+
+static void SndConfigInit(SndConfig *config){
+  config->compression = -1.0;
+  config->vbrquality = -1.0;
+  config->autoheader = 0;
+  config->normfloat = 1;
+  config->normdouble = 1;
+  config->clipping = 0;
+  config->mask = 0;
+}
+
+static int SndConfigLookup(const char *zArg){
+  int i;
+
+  for(i = 0; sndConfigStrs[i]; i++) {
+    if( strcmp(zArg, sndConfigStrs[i])==0 ){
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Pass one setting to libsndfile.  SFC_SET_COMPRESSION_LEVEL and
+ * SFC_SET_VBR_ENCODING_QUALITY return SF_TRUE on success, the boolean
+ * commands return the previous value and cannot fail.
+ */
+static int SndConfigApply(Tcl_Interp *interp, SndFileData *pSnd, int option){
+  SndConfig *config = &pSnd->config;
+  double value;
+
+  switch(option) {
+    case SND_CONFIG_COMPRESSION:
+      value = config->compression;
+      if(sf_command(pSnd->sndfile, SFC_SET_COMPRESSION_LEVEL, &value, sizeof(value)) != SF_TRUE) {
+        Tcl_AppendResult(interp, "Error: -compressionlevel is not supported for this file", (char*)0);
+        return TCL_ERROR;
+      }
+      break;
+    case SND_CONFIG_VBRQUALITY:
+      value = config->vbrquality;
+      if(sf_command(pSnd->sndfile, SFC_SET_VBR_ENCODING_QUALITY, &value, sizeof(value)) != SF_TRUE) {
+        Tcl_AppendResult(interp, "Error: -vbrquality is not supported for this file", (char*)0);
+        return TCL_ERROR;
+      }
+      break;
+    case SND_CONFIG_AUTOHEADER:
+      sf_command(pSnd->sndfile, SFC_SET_UPDATE_HEADER_AUTO, NULL,
+                 config->autoheader ? SF_TRUE : SF_FALSE);
+      break;
+    case SND_CONFIG_NORMFLOAT:
+      sf_command(pSnd->sndfile, SFC_SET_NORM_FLOAT, NULL,
+                 config->normfloat ? SF_TRUE : SF_FALSE);
+      break;
+    case SND_CONFIG_NORMDOUBLE:
+      sf_command(pSnd->sndfile, SFC_SET_NORM_DOUBLE, NULL,
+                 config->normdouble ? SF_TRUE : SF_FALSE);
+      break;
+    case SND_CONFIG_CLIPPING:
+      sf_command(pSnd->sndfile, SFC_SET_CLIPPING, NULL,
+                 config->clipping ? SF_TRUE : SF_FALSE);
+      break;
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Parse one setting.  It is applied right away when the file is open,
+ * otherwise SndMain applies it after sf_open().
+ */
+static int SndConfigSet(Tcl_Interp *interp, SndFileData *pSnd, int option, Tcl_Obj *valueObj){
+  SndConfig *config = &pSnd->config;
+  double value = 0;
+  int flag = 0;
+
+  switch(option) {
+    case SND_CONFIG_COMPRESSION:
+    case SND_CONFIG_VBRQUALITY:
+      if(Tcl_GetDoubleFromObj(interp, valueObj, &value) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(value < 0.0 || value > 1.0) {
+        Tcl_AppendResult(interp, "Error: ", sndConfigStrs[option],
+                         " needs between 0.0 and 1.0", (char*)0);
+        return TCL_ERROR;
+      }
+      break;
+    default:
+      if(Tcl_GetBooleanFromObj(interp, valueObj, &flag) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      break;
+  }
+
+  switch(option) {
+    case SND_CONFIG_COMPRESSION: config->compression = value; break;
+    case SND_CONFIG_VBRQUALITY: config->vbrquality = value; break;
+    case SND_CONFIG_AUTOHEADER: config->autoheader = flag; break;
+    case SND_CONFIG_NORMFLOAT: config->normfloat = flag; break;
+    case SND_CONFIG_NORMDOUBLE: config->normdouble = flag; break;
+    case SND_CONFIG_CLIPPING: config->clipping = flag; break;
+  }
+  config->mask |= (1 << option);
+
+  if(pSnd->sndfile) {
+    return SndConfigApply(interp, pSnd, option);
+  }
+
+  return TCL_OK;
+}
+
+static Tcl_Obj *SndConfigGet(SndFileData *pSnd, int option){
+  SndConfig *config = &pSnd->config;
+
+  switch(option) {
+    case SND_CONFIG_COMPRESSION:
+      return config->compression < 0 ? Tcl_NewStringObj("", 0) : Tcl_NewDoubleObj(config->compression);
+    case SND_CONFIG_VBRQUALITY:
+      return config->vbrquality < 0 ? Tcl_NewStringObj("", 0) : Tcl_NewDoubleObj(config->vbrquality);
+    case SND_CONFIG_AUTOHEADER:
+      return Tcl_NewBooleanObj(config->autoheader);
+    case SND_CONFIG_NORMFLOAT:
+      return Tcl_NewBooleanObj(config->normfloat);
+    case SND_CONFIG_NORMDOUBLE:
+      return Tcl_NewBooleanObj(config->normdouble);
+    case SND_CONFIG_CLIPPING:
+      return Tcl_NewBooleanObj(config->clipping);
+  }
+
+  return Tcl_NewObj();
+}
+
+static sf_count_t SndReadItems(SNDFILE *sndfile, int type, void *ptr, sf_count_t items){
+  switch(type) {
+    case SND_TYPE_SHORT:
+      return sf_read_short(sndfile, (short *) ptr, items);
+    case SND_TYPE_INT:
+      return sf_read_int(sndfile, (int *) ptr, items);
+    case SND_TYPE_FLOAT:
+      return sf_read_float(sndfile, (float *) ptr, items);
+    case SND_TYPE_DOUBLE:
+      return sf_read_double(sndfile, (double *) ptr, items);
+  }
+
+  return 0;
+}
+
+/*
+ * Tail-follow helpers
+ *
+ * A READ handle only knows the frame count from the header it parsed at
+ * open.  When the file size changes, the file is opened again to pick up
+ * the new header, and the new SNDFILE replaces the old one at the same
+ * position.  The writer has to keep the header up to date (for example
+ * with -autoheader 1) for the new frames to show up.
+ */
+
+/*
+ * -follow handles read the file through a Tcl channel.  For PCM, float,
+ * ulaw and alaw encodings the byte offset of the first frame is noted
+ * when the handle is opened.  When the file grows, the frame count is
+ * worked out from the file size and the samples are opened again as
+ * headerless RAW data from that offset, so the header is not parsed
+ * again and the writer does not need to keep it up to date.  This
+ * assumes that the data chunk is the last one, as it is while the file
+ * is being recorded.  Other encodings are opened again from the start.
+ */
+typedef struct SndFollowView SndFollowView;
+
+struct SndFollowView {
+  Tcl_Channel chan;
+  Tcl_WideInt offset;      /* Where the view starts in the file */
+  Tcl_WideInt length;      /* Bytes in the view, -1 for up to the end */
+};
+
+struct SndFollowFile {
+  Tcl_Channel chan;
+  SndFollowView whole;     /* The file, to parse the header */
+  SndFollowView data;      /* The samples, for the RAW reopen */
+  int blockalign;          /* Bytes per frame, 0 to parse the header again */
+  int rawformat;
+  SNDFILE *header;         /* Kept for get_string */
+};
+
+static int SndRawSampleSize(int format);
+static int SndLittleEndian(void);
+
+static sf_count_t SndFollowGetFilelen(void *user_data){
+  SndFollowView *view = (SndFollowView *) user_data;
+  Tcl_WideInt position, end;
+
+  if(view->length >= 0) {
+    return view->length;
+  }
+
+  position = Tcl_Tell(view->chan);
+  end = Tcl_Seek(view->chan, 0, SEEK_END);
+  Tcl_Seek(view->chan, position, SEEK_SET);
+
+  return end < view->offset ? 0 : end - view->offset;
+}
+
+static sf_count_t SndFollowSeek(sf_count_t offset, int whence, void *user_data){
+  SndFollowView *view = (SndFollowView *) user_data;
+  Tcl_WideInt position;
+
+  switch(whence) {
+    case SEEK_SET:
+      position = view->offset + offset;
+      break;
+    case SEEK_CUR:
+      position = Tcl_Tell(view->chan) + offset;
+      break;
+    case SEEK_END:
+      position = view->offset + SndFollowGetFilelen(view) + offset;
+      break;
+    default:
+      return -1;
+  }
+
+  if(position < view->offset) {
+    return -1;
+  }
+
+  position = Tcl_Seek(view->chan, position, SEEK_SET);
+  return position < 0 ? -1 : position - view->offset;
+}
+
+static sf_count_t SndFollowIORead(void *ptr, sf_count_t count, void *user_data){
+  SndFollowView *view = (SndFollowView *) user_data;
+  Tcl_Size n = Tcl_Read(view->chan, (char *) ptr, (Tcl_Size) count);
+
+  return n < 0 ? 0 : n;
+}
+
+static sf_count_t SndFollowIOWrite(const void *ptr, sf_count_t count, void *user_data){
+  return 0;
+}
+
+static sf_count_t SndFollowTell(void *user_data){
+  SndFollowView *view = (SndFollowView *) user_data;
+
+  return Tcl_Tell(view->chan) - view->offset;
+}
+
+static SF_VIRTUAL_IO sndFollowIO = {
+  SndFollowGetFilelen,
+  SndFollowSeek,
+  SndFollowIORead,
+  SndFollowIOWrite,
+  SndFollowTell
+};
+
+static void SndFollowClose(SndFileData *pSnd){
+  SndFollowFile *ff = pSnd->followfile;
+
+  if(ff == NULL) {
+    return;
+  }
+
+  if(ff->header && ff->header != pSnd->sndfile) {
+    sf_close(ff->header);
+  }
+  Tcl_Close(NULL, ff->chan);
+  free(ff);
+  pSnd->followfile = NULL;
+}
+
+/*
+ * Open the file of a -follow handle.  Returns NULL when it cannot be
+ * opened.
+ */
+static SNDFILE *SndFollowOpen(Tcl_Interp *interp, SndFileData *pSnd){
+  SndFollowFile *ff;
+  SNDFILE *sndfile;
+  Tcl_WideInt dataoffset, end;
+  int size, swap;
+
+  ff = (SndFollowFile *) calloc(1, sizeof(SndFollowFile));
+  if(ff == NULL) {
+    return NULL;
+  }
+
+  ff->chan = Tcl_FSOpenFileChannel(interp, pSnd->pathObj, "r", 0);
+  if(ff->chan == NULL) {
+    free(ff);
+    return NULL;
+  }
+  Tcl_SetChannelOption(NULL, ff->chan, "-translation", "binary");
+
+  ff->whole.chan = ff->data.chan = ff->chan;
+  ff->whole.length = -1;
+  sndfile = sf_open_virtual(&sndFollowIO, SFM_READ, &pSnd->sfinfo, &ff->whole);
+  if(sndfile == NULL) {
+    Tcl_Close(NULL, ff->chan);
+    free(ff);
+    return NULL;
+  }
+
+  /* Where the library goes for frame 0 is the start of the samples */
+  size = SndRawSampleSize(pSnd->sfinfo.format);
+  if(size > 0 && sf_seek(sndfile, 0, SEEK_SET) == 0) {
+    dataoffset = Tcl_Tell(ff->chan);
+    end = SndFollowGetFilelen(&ff->whole);
+
+    if(dataoffset >= 0 &&
+       dataoffset + pSnd->sfinfo.frames * size * pSnd->sfinfo.channels <= end) {
+      swap = sf_command(sndfile, SFC_RAW_DATA_NEEDS_ENDSWAP, NULL, 0) ? 1 : 0;
+      ff->data.offset = dataoffset;
+      ff->blockalign = size * pSnd->sfinfo.channels;
+      ff->rawformat = SF_FORMAT_RAW | (pSnd->sfinfo.format & SF_FORMAT_SUBMASK) |
+                      (SndLittleEndian() != swap ? SF_ENDIAN_LITTLE : SF_ENDIAN_BIG);
+    }
+  }
+
+  ff->header = sndfile;
+  pSnd->followfile = ff;
+  return sndfile;
+}
+
+static Tcl_WideInt SndFollowFileSize(SndFileData *pSnd){
+  Tcl_StatBuf *statBuf = Tcl_AllocStatBuf();
+  Tcl_WideInt size = -1;
+
+  if(Tcl_FSStat(pSnd->pathObj, statBuf) == 0) {
+    size = (Tcl_WideInt) Tcl_GetSizeFromStat(statBuf);
+  }
+  Tcl_Free((char *) statBuf);
+
+  return size;
+}
+
+/*
+ * Return the number of frames that can be read from the current position,
+ * opening the file again when it has grown.
+ */
+static sf_count_t SndFollowRefresh(SndFileData *pSnd){
+  SndFollowFile *ff = pSnd->followfile;
+  SNDFILE *sndfile;
+  SF_INFO sfinfo;
+  sf_count_t position, frames;
+  Tcl_WideInt size;
+  int option;
+
+  position = sf_seek(pSnd->sndfile, 0, SEEK_CUR);
+  if(position < 0) {
+    return 0;
+  }
+
+  size = SndFollowFileSize(pSnd);
+  if(size < 0 || size == pSnd->filesize) {
+    return pSnd->sfinfo.frames - position;
+  }
+
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  if(ff->blockalign > 0) {
+    frames = (size - ff->data.offset) / ff->blockalign;
+    if(frames <= pSnd->sfinfo.frames) {
+      pSnd->filesize = size;
+      return pSnd->sfinfo.frames - position;
+    }
+
+    sfinfo.samplerate = pSnd->sfinfo.samplerate;
+    sfinfo.channels = pSnd->sfinfo.channels;
+    sfinfo.format = ff->rawformat;
+    ff->data.length = frames * ff->blockalign;
+    sndfile = sf_open_virtual(&sndFollowIO, SFM_READ, &sfinfo, &ff->data);
+  } else {
+    sndfile = sf_open_virtual(&sndFollowIO, SFM_READ, &sfinfo, &ff->whole);
+  }
+
+  if(sndfile == NULL) {
+    return pSnd->sfinfo.frames - position;
+  }
+
+  if(sfinfo.channels != pSnd->sfinfo.channels || sfinfo.frames < position ||
+     sf_seek(sndfile, position, SEEK_SET) != position) {
+    sf_close(sndfile);
+    sf_seek(pSnd->sndfile, position, SEEK_SET);
+    return pSnd->sfinfo.frames - position;
+  }
+
+  if(pSnd->sndfile != ff->header) {
+    sf_close(pSnd->sndfile);
+  }
+  if(ff->blockalign == 0) {
+    /* A new header replaces the old one */
+    if(ff->header != pSnd->sndfile) {
+      sf_close(ff->header);
+    }
+    ff->header = sndfile;
+    pSnd->sfinfo = sfinfo;
+  } else {
+    pSnd->sfinfo.frames = sfinfo.frames;
+  }
+  pSnd->sndfile = sndfile;
+  pSnd->filesize = size;
+
+  for(option = SND_CONFIG_AUTOHEADER; sndConfigStrs[option]; option++) {
+    if(pSnd->config.mask & (1 << option)) {
+      SndConfigApply(pSnd->interp, pSnd, option);
+    }
+  }
+
+  return pSnd->sfinfo.frames - position;
+}
+
+static void SndFollowWakeProc(ClientData clientData){
+  *(int *) clientData = 1;
+}
+
+/*
+ * Called when read_* hits the end in follow mode.  Wait up to
+ * -followtimeout milliseconds for new frames, running the event loop
+ * in between checks like vwait does.  Returns -1 when the handle was
+ * closed meanwhile.
+ */
+static sf_count_t SndFollowRead(SndFileData *pSnd, SndBuffer *buf){
+  Tcl_Time start, now;
+  Tcl_TimerToken timer;
+  sf_count_t read_count = 0;
+  long elapsed = 0;
+  long wait;
+  int fired;
+
+  Tcl_GetTime(&start);
+  Tcl_Preserve(pSnd);
+  SndBufferRetain(buf);
+  pSnd->followwaiting = 1;
+
+  for(;;) {
+    if(pSnd->sndfile == NULL) {
+      read_count = -1;
+      break;
+    }
+
+    if(SndFollowRefresh(pSnd) > 0) {
+      read_count = SndReadItems(pSnd->sndfile, buf->type, buf->data, buf->capacity);
+      if(read_count > 0) {
+        break;
+      }
+    }
+
+    Tcl_GetTime(&now);
+    elapsed = (now.sec - start.sec) * 1000 + (now.usec - start.usec) / 1000;
+    if(elapsed >= pSnd->followtimeout) {
+      read_count = 0;
+      break;
+    }
+
+    wait = pSnd->followtimeout - elapsed;
+    fired = 0;
+    timer = Tcl_CreateTimerHandler(wait < pSnd->pollinterval ? wait : pSnd->pollinterval,
+                                   SndFollowWakeProc, &fired);
+    while(!fired) {
+      Tcl_DoOneEvent(TCL_ALL_EVENTS);
+    }
+    (void) timer;
+  }
+
+  pSnd->followwaiting = 0;
+  SndBufferRelease(buf);
+  Tcl_Release(pSnd);
+
+  return read_count;
+}
+
+static void SndFollowTimerProc(ClientData clientData){
+  SndFileData *pSnd = (SndFileData *) clientData;
+  Tcl_Interp *interp = pSnd->interp;
+  Tcl_Obj *script = pSnd->availableScript;
+  int result;
+
+  pSnd->followTimer = Tcl_CreateTimerHandler(pSnd->pollinterval,
+                                             SndFollowTimerProc, pSnd);
+
+  if(SndFollowRefresh(pSnd) <= 0) {
+    return;
+  }
+
+  /*
+   * The script may close the handle, so do not touch pSnd afterwards.
+   */
+  Tcl_Preserve(interp);
+  Tcl_IncrRefCount(script);
+  result = Tcl_EvalObjEx(interp, script, TCL_EVAL_GLOBAL);
+  if(result != TCL_OK) {
+    Tcl_BackgroundException(interp, result);
+  }
+  Tcl_DecrRefCount(script);
+  Tcl_Release(interp);
+}
+
+static void SndFollowStop(SndFileData *pSnd){
+  if(pSnd->followTimer) {
+    Tcl_DeleteTimerHandler(pSnd->followTimer);
+    pSnd->followTimer = NULL;
+  }
+
+  if(pSnd->availableScript) {
+    Tcl_DecrRefCount(pSnd->availableScript);
+    pSnd->availableScript = NULL;
+  }
+}
+
+static sf_count_t SndParallelRead(SndParallel *par, int type, void *ptr, sf_count_t frames);
+
+static int SndReadBlock(Tcl_Interp *interp, SndFileData *pSnd, int type){
+  SndBuffer *buf;
+  sf_count_t read_count = 0;
+  int channels = pSnd->sfinfo.channels;
+
+  if(pSnd->followwaiting) {
+    Tcl_AppendResult(interp, "Error: read_* is already waiting for new frames", (char*)0);
+    return TCL_ERROR;
+  }
+
+  buf = SndGetBlock(pSnd, type);
+  if( buf == 0 ){
+    Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+    return TCL_ERROR;
+  }
+
+  if(pSnd->parallel) {
+    read_count = SndParallelRead(pSnd->parallel, type, buf->data, buf->capacity / channels) * channels;
+  } else {
+    read_count = SndReadItems(pSnd->sndfile, type, buf->data, buf->capacity);
+  }
+
+  /*
+   * In follow mode the end of the file is not an error, an empty buffer
+   * tells the caller that no new frames are available yet.
+   */
+  if(read_count <= 0 && pSnd->follow) {
+     read_count = SndFollowRead(pSnd, buf);
+     if(read_count < 0) {
+       Tcl_ResetResult(interp);
+       Tcl_AppendResult(interp, "Error: the handle was closed while read_* waited", (char*)0);
+       return TCL_ERROR;
+     }
+     buf->items = read_count;
+     Tcl_SetObjResult(interp, SndBufferNewObj(buf));
+     return TCL_OK;
+  }
+
+  if(read_count <= 0) {
+     return TCL_ERROR;
+  }
+
+  buf->items = read_count;
+  Tcl_SetObjResult(interp, SndBufferNewObj(buf));
+  return TCL_OK;
+}
+
+/*
+ * Dither
+ *
+ * write_float and write_double on a handle with -dither quantize to the
+ * bit depth of the encoding here instead of in libsndfile, and write the
+ * result with sf_write_int.  tpdf adds triangular noise of +-1 LSB before
+ * rounding.  shaped also feeds the error back through 2z^-1 - z^-2, which
+ * moves the noise up to high frequencies as (1 - z^-1)^2.  The noise comes
+ * from a hash of a running sample counter, so the tpdf kernel has no
+ * dependency between samples and the compiler can vectorize it.
+ */
+
+enum SndDither {
+  SND_DITHER_NONE,
+  SND_DITHER_TPDF,
+  SND_DITHER_SHAPED
+};
+
+static const char *sndDitherNames[] = {
+  "none", "tpdf", "shaped", 0
+};
+
+static int SndDitherBits(int format){
+  switch(format & SF_FORMAT_SUBMASK) {
+    case SF_FORMAT_PCM_S8:
+    case SF_FORMAT_PCM_U8:
+    case SF_FORMAT_DPCM_8:
+      return 8;
+    case SF_FORMAT_DWVW_12:
+      return 12;
+    case SF_FORMAT_PCM_16:
+    case SF_FORMAT_DPCM_16:
+    case SF_FORMAT_DWVW_16:
+      return 16;
+    case SF_FORMAT_PCM_24:
+    case SF_FORMAT_DWVW_24:
+      return 24;
+  }
+
+  return 0;
+}
+
+/*
+ * Triangular noise in (-1, 1) for sample number n: the two halves of a
+ * 64 bit hash of n (the splitmix64 finalizer), so that the noise does
+ * not repeat within 2^64 samples.
+ */
+static double SndDitherNoise(Tcl_WideUInt n){
+  n = (n + 1) * 0x9E3779B97F4A7C15ULL;
+  n = (n ^ (n >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  n = (n ^ (n >> 27)) * 0x94D049BB133111EBULL;
+  n ^= n >> 31;
+  return ((double) (n & 0xFFFFFFFFU) + (double) (n >> 32)) * (1.0 / 4294967296.0) - 1.0;
+}
+
+static int SndQuantize(double v, double lo, double hi, int shift){
+  v = floor(v + 0.5);
+  if(v < lo) v = lo;
+  if(v > hi) v = hi;
+  return (int) v * (1 << shift);
+}
+
+static void SndDitherTpdf(SndFileData *pSnd, int type, const void *in, int *out,
+                          sf_count_t items, double scale){
+  int bits = pSnd->ditherbits;
+  int shift = 32 - bits;
+  double lo = -ldexp(1.0, bits - 1), hi = ldexp(1.0, bits - 1) - 1.0;
+  Tcl_WideUInt count = pSnd->dithercount;
+  sf_count_t i;
+
+  if(type == SND_TYPE_FLOAT) {
+    const float *x = (const float *) in;
+    for(i = 0; i < items; i++) {
+      out[i] = SndQuantize(x[i] * scale + SndDitherNoise(count + (Tcl_WideUInt) i), lo, hi, shift);
+    }
+  } else {
+    const double *x = (const double *) in;
+    for(i = 0; i < items; i++) {
+      out[i] = SndQuantize(x[i] * scale + SndDitherNoise(count + (Tcl_WideUInt) i), lo, hi, shift);
+    }
+  }
+
+  pSnd->dithercount = count + (Tcl_WideUInt) items;
+}
+
+static void SndDitherShaped(SndFileData *pSnd, int type, const void *in, int *out,
+                            sf_count_t items, double scale){
+  int bits = pSnd->ditherbits;
+  int shift = 32 - bits;
+  int channels = pSnd->sfinfo.channels;
+  double lo = -ldexp(1.0, bits - 1), hi = ldexp(1.0, bits - 1) - 1.0;
+  int channel = (int) (pSnd->dithercount % (Tcl_WideUInt) channels);
+  double *state;
+  double x, v, q;
+  sf_count_t i;
+
+  /* The channel of a sample follows from the counter, across calls too */
+  for(i = 0; i < items; i++) {
+    state = pSnd->ditherstate + 2 * channel;
+    if(++channel == channels) channel = 0;
+    x = type == SND_TYPE_FLOAT ? ((const float *) in)[i] : ((const double *) in)[i];
+    v = x * scale - (2.0 * state[0] - state[1]);
+    q = floor(v + SndDitherNoise(pSnd->dithercount++) + 0.5);
+
+    /* The error is taken before clipping so that overloads do not build up */
+    state[1] = state[0];
+    state[0] = q - v;
+
+    if(q < lo) q = lo;
+    if(q > hi) q = hi;
+    out[i] = (int) q * (1 << shift);
+  }
+}
+
+/*
+ * Write items of float or double samples through the dither.  Return the
+ * number of items written, or -1 when the block cannot hold a frame.
+ * "buf" is the int block to dither into; the handle's own when NULL.
+ * libsndfile only writes whole frames, so the samples of a frame that the
+ * call does not complete are kept and written ahead of the next call.
+ */
+static sf_count_t SndDitherWrite(SndFileData *pSnd, int type, const unsigned char *data,
+                                 sf_count_t items, SndBuffer *buf){
+  int channels = pSnd->sfinfo.channels;
+  int norm = type == SND_TYPE_FLOAT ? pSnd->config.normfloat : pSnd->config.normdouble;
+  double scale = norm ? ldexp(1.0, pSnd->ditherbits - 1) : 1.0;
+  sf_count_t total = 0, chunk, n, m, whole, written;
+  int *out;
+
+  if(buf == NULL) {
+    buf = SndGetBlock(pSnd, SND_TYPE_INT);
+  }
+  if(buf == NULL) {
+    return -2;
+  }
+  if(buf->capacity < channels) {
+    return -1;
+  }
+  chunk = buf->capacity - buf->capacity % channels;
+  out = (int *) buf->data;
+
+  while(total < items) {
+    memcpy(out, pSnd->ditherpending, pSnd->npending * sizeof(int));
+    n = items - total < chunk - pSnd->npending ? items - total : chunk - pSnd->npending;
+
+    if(pSnd->dither == SND_DITHER_SHAPED) {
+      SndDitherShaped(pSnd, type, data + total * sndTypeSizes[type], out + pSnd->npending, n, scale);
+    } else {
+      SndDitherTpdf(pSnd, type, data + total * sndTypeSizes[type], out + pSnd->npending, n, scale);
+    }
+
+    m = pSnd->npending + n;
+    whole = m - m % channels;
+    written = whole > 0 ? sf_write_int(pSnd->sndfile, out, whole) : 0;
+    if(written != whole) {
+      written -= pSnd->npending;
+      pSnd->npending = 0;
+      return total + (written > 0 ? written : 0);
+    }
+
+    pSnd->npending = (int) (m - whole);
+    memcpy(pSnd->ditherpending, out + whole, pSnd->npending * sizeof(int));
+    total += n;
+  }
+
+  return total;
+}
+
+/*
+ * Write items of "type", through the dither when there is one.  Return
+ * the number of items written, -1 when the dither block cannot hold a
+ * frame or -2 when it cannot be allocated.  Other threads than the one of
+ * the interpreter pass their own "scratch" int block for the dither.
+ */
+static sf_count_t SndWriteItems(SndFileData *pSnd, int type, const unsigned char *data,
+                                sf_count_t items, SndBuffer *scratch){
+  if(pSnd->ditherbits > 0 && (type == SND_TYPE_FLOAT || type == SND_TYPE_DOUBLE)) {
+    return SndDitherWrite(pSnd, type, data, items, scratch);
+  }
+
+  switch(type) {
+    case SND_TYPE_SHORT:
+      return sf_write_short(pSnd->sndfile, (const short *) data, items);
+    case SND_TYPE_INT:
+      return sf_write_int(pSnd->sndfile, (const int *) data, items);
+    case SND_TYPE_FLOAT:
+      return sf_write_float(pSnd->sndfile, (const float *) data, items);
+    case SND_TYPE_DOUBLE:
+      return sf_write_double(pSnd->sndfile, (const double *) data, items);
+  }
+
+  return 0;
+}
+
+static int SndAsyncWrite(Tcl_Interp *interp, SndFileData *pSnd, int type,
+                         const unsigned char *data, sf_count_t items);
+
+static int SndWriteBlock(Tcl_Interp *interp, SndFileData *pSnd, int type, Tcl_Obj *objPtr){
+  SndBuffer *buf = SndBufferFromObj(objPtr);
+  unsigned char *zData = NULL;
+  Tcl_Size len;
+  sf_count_t count = 0;
+  sf_count_t items;
+
+  /* A byte array is taken as it is, a sample buffer has to match */
+  if(buf && buf->type != type) {
+    Tcl_AppendResult(interp, "Error: write_", sndTypeNames[type], " needs a ",
+                     sndTypeNames[type], " buffer, got ", sndTypeNames[buf->type], (char*)0);
+    return TCL_ERROR;
+  }
+
+  zData = SndGetBytesFromObj(objPtr, &len);
+  if( !zData || len < 1 ){
+      return TCL_ERROR;
+  }
+
+  items = len / sndTypeSizes[type];
+
+  if(pSnd->async) {
+    return SndAsyncWrite(interp, pSnd, type, zData, items);
+  }
+
+  count = SndWriteItems(pSnd, type, zData, items, NULL);
+  if(count < 0) {
+    Tcl_AppendResult(interp, count == -1 ? "Error: buffersize needs >= channels" : SndAllocError(),
+                     (char*)0);
+    return TCL_ERROR;
+  }
+
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) count));
+  return TCL_OK;
+}
+
+
+/*
+ * Helpers for commands that open files by themselves
+ */
+
+static SNDFILE *SndOpenFile(Tcl_Interp *interp, Tcl_Obj *pathObj, int mode, SF_INFO *sfinfo){
+  Tcl_DString translatedFilename;
+  const char *zFile;
+  SNDFILE *sndfile;
+
+  zFile = Tcl_TranslateFileName(interp, Tcl_GetString(pathObj), &translatedFilename);
+  if(zFile == NULL) {
+    return NULL;
+  }
+
+  sndfile = sf_open(zFile, mode, sfinfo);
+  Tcl_DStringFree(&translatedFilename);
+
+  if(sndfile == NULL) {
+    Tcl_AppendResult(interp, "Error: ", Tcl_GetString(pathObj), ": ",
+                     sf_strerror(NULL), (char*)0);
+  }
+
+  return sndfile;
+}
+
+/*
+ * Sample type that copies the data of a file without loss: integer PCM
+ * goes through int, everything else through double.
+ */
+static int SndLosslessType(int format){
+  switch(format & SF_FORMAT_SUBMASK) {
+    case SF_FORMAT_FLOAT:
+    case SF_FORMAT_DOUBLE:
+    case SF_FORMAT_VORBIS:
+      return SND_TYPE_DOUBLE;
+  }
+
+  return SND_TYPE_INT;
+}
+
+static sf_count_t SndReadFrames(SNDFILE *sndfile, int type, void *ptr, sf_count_t frames){
+  switch(type) {
+    case SND_TYPE_SHORT:
+      return sf_readf_short(sndfile, (short *) ptr, frames);
+    case SND_TYPE_INT:
+      return sf_readf_int(sndfile, (int *) ptr, frames);
+    case SND_TYPE_FLOAT:
+      return sf_readf_float(sndfile, (float *) ptr, frames);
+    case SND_TYPE_DOUBLE:
+      return sf_readf_double(sndfile, (double *) ptr, frames);
+  }
+
+  return 0;
+}
+
+static sf_count_t SndWriteFrames(SNDFILE *sndfile, int type, const void *ptr, sf_count_t frames){
+  switch(type) {
+    case SND_TYPE_SHORT:
+      return sf_writef_short(sndfile, (const short *) ptr, frames);
+    case SND_TYPE_INT:
+      return sf_writef_int(sndfile, (const int *) ptr, frames);
+    case SND_TYPE_FLOAT:
+      return sf_writef_float(sndfile, (const float *) ptr, frames);
+    case SND_TYPE_DOUBLE:
+      return sf_writef_double(sndfile, (const double *) ptr, frames);
+  }
+
+  return 0;
+}
+
+/*
+ * Copy up to "frames" frames (all of them when < 0) from the current
+ * position of "in" to "out".  Return the number of frames copied, or -1
+ * when the output fails.
+ */
+static sf_count_t SndCopyFrames(SNDFILE *in, SNDFILE *out, int type, void *block,
+                                sf_count_t blockframes, sf_count_t frames){
+  sf_count_t total = 0;
+  sf_count_t want, got;
+
+  while(frames < 0 || total < frames) {
+    want = blockframes;
+    if(frames >= 0 && frames - total < want) {
+      want = frames - total;
+    }
+
+    got = SndReadFrames(in, type, block, want);
+    if(got <= 0) {
+      break;
+    }
+
+    if(SndWriteFrames(out, type, block, got) != got) {
+      return -1;
+    }
+    total += got;
+  }
+
+  return total;
+}
+
+/*
+ * Bytes per sample of encodings that store every sample on its own, so
+ * that the data of two files can be joined without decoding.  Return 0
+ * for other encodings.
+ */
+static int SndRawSampleSize(int format){
+  switch(format & SF_FORMAT_SUBMASK) {
+    case SF_FORMAT_PCM_S8:
+    case SF_FORMAT_PCM_U8:
+    case SF_FORMAT_ULAW:
+    case SF_FORMAT_ALAW:
+      return 1;
+    case SF_FORMAT_PCM_16:
+      return 2;
+    case SF_FORMAT_PCM_24:
+      return 3;
+    case SF_FORMAT_PCM_32:
+    case SF_FORMAT_FLOAT:
+      return 4;
+    case SF_FORMAT_DOUBLE:
+      return 8;
+  }
+
+  return 0;
+}
+
+/*
+ * Copy the encoded data of "in" to "out" with sf_read_raw/sf_write_raw.
+ * Both files need the same format and channel count.  Return the number
+ * of frames copied, or -1 when the output fails.
+ */
+static sf_count_t SndCopyRaw(SNDFILE *in, SNDFILE *out, void *block, sf_count_t blockbytes,
+                             int framesize){
+  sf_count_t total = 0;
+  sf_count_t got;
+
+  blockbytes -= blockbytes % framesize;
+
+  while((got = sf_read_raw(in, block, blockbytes)) > 0) {
+    got -= got % framesize;
+    if(got == 0) {
+      break;
+    }
+
+    if(sf_write_raw(out, block, got) != got) {
+      return -1;
+    }
+    total += got / framesize;
+  }
+
+  return total;
+}
+
+/*
+ * Short-time Fourier transform
+ *
+ * A real FFT of size n is done as a complex radix-2 FFT of size n/2 on
+ * the even/odd samples, followed by a split step.  Twiddle factors and
+ * the bit reverse table are computed once per call.
+ */
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const char *sndWindowNames[] = {
+  "hann", "hamming", "blackman", "rectangular", 0
+};
+
+enum SndWindowEnum {
+  SND_WINDOW_HANN,
+  SND_WINDOW_HAMMING,
+  SND_WINDOW_BLACKMAN,
+  SND_WINDOW_RECTANGULAR,
+};
+
+static const char *sndScaleNames[] = {
+  "power", "magnitude", "db", 0
+};
+
+enum SndScaleEnum {
+  SND_SCALE_POWER,
+  SND_SCALE_MAGNITUDE,
+  SND_SCALE_DB,
+};
+
+typedef struct SndMelBand SndMelBand;
+
+struct SndMelBand {
+  int first;               /* First FFT bin */
+  int count;
+  float *weights;
+};
+
+typedef struct SndFFT SndFFT;
+
+struct SndFFT {
+  int n;                   /* Real transform size */
+  int m;                   /* n / 2, complex transform size */
+  int *bitrev;
+  float *twr, *twi;        /* m / 2 twiddles of the complex FFT */
+  float *spr, *spi;        /* m twiddles of the split step */
+  float *window;
+  float *re, *im;
+  float *power;            /* n / 2 + 1 bins */
+  int bands;
+  SndMelBand *mel;
+};
+
+static void SndFFTFree(SndFFT *fft){
+  int i;
+
+  if(fft->mel) {
+    for(i = 0; i < fft->bands; i++) {
+      free(fft->mel[i].weights);
+    }
+    free(fft->mel);
+  }
+  free(fft->bitrev);
+  free(fft->twr);
+  free(fft->twi);
+  free(fft->spr);
+  free(fft->spi);
+  free(fft->window);
+  free(fft->re);
+  free(fft->im);
+  free(fft->power);
+}
+
+static double SndHzToMel(double hz){
+  return 2595.0 * log10(1.0 + hz / 700.0);
+}
+
+static double SndMelToHz(double mel){
+  return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+/*
+ * Triangular filters evenly spaced on the mel scale from 0 Hz to the
+ * Nyquist frequency.
+ */
+static int SndMelInit(SndFFT *fft, int bands, int samplerate){
+  int bins = fft->n / 2 + 1;
+  double top = SndHzToMel(samplerate / 2.0);
+  double lo, mid, hi, f;
+  int b, k, first, last;
+
+  fft->mel = (SndMelBand *) calloc(bands, sizeof(SndMelBand));
+  if(fft->mel == NULL) {
+    return TCL_ERROR;
+  }
+  fft->bands = bands;
+
+  for(b = 0; b < bands; b++) {
+    lo = SndMelToHz(top * b / (bands + 1));
+    mid = SndMelToHz(top * (b + 1) / (bands + 1));
+    hi = SndMelToHz(top * (b + 2) / (bands + 1));
+
+    first = (int) ceil(lo * fft->n / samplerate);
+    last = (int) floor(hi * fft->n / samplerate);
+    if(last >= bins) last = bins - 1;
+    if(last < first) last = first - 1;
+
+    fft->mel[b].first = first;
+    fft->mel[b].count = last - first + 1;
+    if(fft->mel[b].count <= 0) {
+      continue;
+    }
+
+    fft->mel[b].weights = (float *) malloc(fft->mel[b].count * sizeof(float));
+    if(fft->mel[b].weights == NULL) {
+      return TCL_ERROR;
+    }
+
+    for(k = first; k <= last; k++) {
+      f = (double) k * samplerate / fft->n;
+      fft->mel[b].weights[k - first] = (float) (f <= mid ?
+          (f - lo) / (mid - lo) : (hi - f) / (hi - mid));
+    }
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Bytes that SndFFTInit and SndMelInit allocate at most
+ */
+static Tcl_WideInt SndFFTBytes(int n, int bands){
+  Tcl_WideInt m = n / 2;
+
+  return m * sizeof(int) + (m + 2 + 4 * m + n + m + 1) * sizeof(float) +
+         (Tcl_WideInt) bands * (sizeof(SndMelBand) + (m + 1) * sizeof(float));
+}
+
+static int SndFFTInit(SndFFT *fft, int n, int window){
+  int m = n / 2;
+  int bits = 0;
+  int i, j;
+  double a;
+
+  memset(fft, 0, sizeof(*fft));
+  fft->n = n;
+  fft->m = m;
+
+  while((1 << bits) < m) bits++;
+
+  fft->bitrev = (int *) malloc(m * sizeof(int));
+  fft->twr = (float *) malloc((m / 2 + 1) * sizeof(float));
+  fft->twi = (float *) malloc((m / 2 + 1) * sizeof(float));
+  fft->spr = (float *) malloc(m * sizeof(float));
+  fft->spi = (float *) malloc(m * sizeof(float));
+  fft->window = (float *) malloc(n * sizeof(float));
+  fft->re = (float *) malloc(m * sizeof(float));
+  fft->im = (float *) malloc(m * sizeof(float));
+  fft->power = (float *) malloc((m + 1) * sizeof(float));
+  if(!fft->bitrev || !fft->twr || !fft->twi || !fft->spr || !fft->spi ||
+     !fft->window || !fft->re || !fft->im || !fft->power) {
+    return TCL_ERROR;
+  }
+
+  for(i = 0; i < m; i++) {
+    int r = 0;
+    for(j = 0; j < bits; j++) {
+      if(i & (1 << j)) r |= 1 << (bits - 1 - j);
+    }
+    fft->bitrev[i] = r;
+  }
+
+  for(i = 0; i < m / 2 + 1; i++) {
+    a = -2.0 * M_PI * i / m;
+    fft->twr[i] = (float) cos(a);
+    fft->twi[i] = (float) sin(a);
+  }
+
+  for(i = 0; i < m; i++) {
+    a = -2.0 * M_PI * i / n;
+    fft->spr[i] = (float) cos(a);
+    fft->spi[i] = (float) sin(a);
+  }
+
+  for(i = 0; i < n; i++) {
+    a = 2.0 * M_PI * i / n;
+    switch(window) {
+      case SND_WINDOW_HANN:
+        fft->window[i] = (float) (0.5 - 0.5 * cos(a));
+        break;
+      case SND_WINDOW_HAMMING:
+        fft->window[i] = (float) (0.54 - 0.46 * cos(a));
+        break;
+      case SND_WINDOW_BLACKMAN:
+        fft->window[i] = (float) (0.42 - 0.5 * cos(a) + 0.08 * cos(2.0 * a));
+        break;
+      default:
+        fft->window[i] = 1.0f;
+        break;
+    }
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Power spectrum of n real samples into fft->power[0 .. n/2]
+ */
+static void SndFFTPower(SndFFT *fft, const float *in){
+  float *re = fft->re, *im = fft->im;
+  int m = fft->m;
+  int size, half, step, i, j, k;
+
+  for(i = 0; i < m; i++) {
+    j = fft->bitrev[i];
+    re[j] = in[2 * i] * fft->window[2 * i];
+    im[j] = in[2 * i + 1] * fft->window[2 * i + 1];
+  }
+
+  for(size = 2; size <= m; size *= 2) {
+    half = size / 2;
+    step = m / size;
+    for(i = 0; i < m; i += size) {
+      for(k = 0; k < half; k++) {
+        float wr = fft->twr[k * step], wi = fft->twi[k * step];
+        float xr = re[i + k + half], xi = im[i + k + half];
+        float tr = xr * wr - xi * wi;
+        float ti = xr * wi + xi * wr;
+
+        re[i + k + half] = re[i + k] - tr;
+        im[i + k + half] = im[i + k] - ti;
+        re[i + k] += tr;
+        im[i + k] += ti;
+      }
+    }
+  }
+
+  /*
+   * Split step: X[k] = E[k] + W^k O[k] where E and O are the transforms
+   * of the even and odd samples, taken from Z[k] and conj(Z[m-k]).
+   */
+  fft->power[0] = (re[0] + im[0]) * (re[0] + im[0]);
+  fft->power[m] = (re[0] - im[0]) * (re[0] - im[0]);
+
+  for(k = 1; k < m; k++) {
+    float ar = re[k], ai = im[k];
+    float br = re[m - k], bi = -im[m - k];
+    float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+    float or_ = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+    float xr = er + fft->spr[k] * or_ - fft->spi[k] * oi;
+    float xi = ei + fft->spr[k] * oi + fft->spi[k] * or_;
+
+    fft->power[k] = xr * xr + xi * xi;
+  }
+}
+
+/*
+ * Turn the power spectrum into one output row of "columns" values.
+ */
+static void SndSpectrumRow(SndFFT *fft, int scale, float *row){
+  int columns = fft->bands ? fft->bands : fft->m + 1;
+  int b, k;
+  float v;
+
+  for(b = 0; b < columns; b++) {
+    if(fft->bands) {
+      v = 0.0f;
+      for(k = 0; k < fft->mel[b].count; k++) {
+        v += fft->mel[b].weights[k] * fft->power[fft->mel[b].first + k];
+      }
+    } else {
+      v = fft->power[b];
+    }
+
+    switch(scale) {
+      case SND_SCALE_MAGNITUDE:
+        v = sqrtf(v);
+        break;
+      case SND_SCALE_DB:
+        v = 10.0f * log10f(v + 1e-20f);
+        break;
+    }
+    row[b] = v;
+  }
+}
+
+/*
+ * Loudness measurement (ITU-R BS.1770-4, EBU R128 and EBU Tech 3342)
+ *
+ * The K-weighting filter is a high shelf followed by a high pass, with the
+ * coefficients derived for any sample rate.  Mean square energy is summed
+ * per 100 ms step; 400 ms gating blocks and 3 s short-term windows are
+ * built from the steps afterwards.  True peak uses 4x oversampling with a
+ * 48 tap polyphase interpolation filter.
+ */
+
+#define SND_TP_TAPS 12     /* Taps per phase */
+#define SND_TP_PHASES 4
+
+typedef struct SndBiquad SndBiquad;
+
+struct SndBiquad {
+  double b0, b1, b2, a1, a2;
+};
+
+typedef struct SndLoudness SndLoudness;
+
+struct SndLoudness {
+  int channels;
+  SndBiquad shelf, highpass;
+  double *state;           /* 4 per channel: two per filter stage */
+  double *weights;
+  double *sums;            /* Per channel sum of the current step */
+  sf_count_t stepframes;   /* Frames in 100 ms */
+  sf_count_t counter;
+  double *steps;           /* Weighted mean square of each 100 ms step */
+  size_t nsteps;
+  size_t allocated;
+  double taps[SND_TP_PHASES][SND_TP_TAPS];
+  double *history;         /* SND_TP_TAPS past samples per channel */
+  int hpos;
+  double truepeak;
+  double samplepeak;
+  Tcl_WideInt charged;     /* Bytes counted in the memory budget */
+};
+
+static void SndLoudnessFree(SndLoudness *ld){
+  SndMemoryUncharge(ld->charged);
+  ld->charged = 0;
+  free(ld->state);
+  free(ld->weights);
+  free(ld->sums);
+  free(ld->steps);
+  free(ld->history);
+}
+
+static int SndLoudnessInit(SndLoudness *ld, int channels, int samplerate){
+  double f0, G, Q, K, Vh, Vb, a0, h, x, total;
+  Tcl_WideInt nbytes = (Tcl_WideInt) channels * (6 + SND_TP_TAPS) * sizeof(double);
+  int c, i, p;
+
+  memset(ld, 0, sizeof(*ld));
+  ld->channels = channels;
+  ld->stepframes = (samplerate + 5) / 10;
+  if(ld->stepframes < 1) ld->stepframes = 1;
+
+  if(!SndMemoryCharge(nbytes)) {
+    return TCL_ERROR;
+  }
+  ld->charged = nbytes;
+
+  ld->state = (double *) calloc(channels * 4, sizeof(double));
+  ld->weights = (double *) malloc(channels * sizeof(double));
+  ld->sums = (double *) calloc(channels, sizeof(double));
+  ld->history = (double *) calloc(channels * SND_TP_TAPS, sizeof(double));
+  if(!ld->state || !ld->weights || !ld->sums || !ld->history) {
+    return TCL_ERROR;
+  }
+
+  /*
+   * Channel weights: surround channels count 1.41, the LFE of a 5.1
+   * file (L R C LFE Ls Rs) is left out.
+   */
+  for(c = 0; c < channels; c++) {
+    ld->weights[c] = 1.0;
+    if(channels == 5 && c >= 3) ld->weights[c] = 1.41;
+    if(channels == 6 && c == 3) ld->weights[c] = 0.0;
+    if(channels == 6 && c >= 4) ld->weights[c] = 1.41;
+  }
+
+  f0 = 1681.974450955533;
+  G = 3.999843853973347;
+  Q = 0.7071752369554196;
+  K = tan(M_PI * f0 / samplerate);
+  Vh = pow(10.0, G / 20.0);
+  Vb = pow(Vh, 0.4996667741545416);
+  a0 = 1.0 + K / Q + K * K;
+  ld->shelf.b0 = (Vh + Vb * K / Q + K * K) / a0;
+  ld->shelf.b1 = 2.0 * (K * K - Vh) / a0;
+  ld->shelf.b2 = (Vh - Vb * K / Q + K * K) / a0;
+  ld->shelf.a1 = 2.0 * (K * K - 1.0) / a0;
+  ld->shelf.a2 = (1.0 - K / Q + K * K) / a0;
+
+  f0 = 38.13547087602444;
+  Q = 0.5003270373238773;
+  K = tan(M_PI * f0 / samplerate);
+  a0 = 1.0 + K / Q + K * K;
+  ld->highpass.b0 = 1.0;
+  ld->highpass.b1 = -2.0;
+  ld->highpass.b2 = 1.0;
+  ld->highpass.a1 = 2.0 * (K * K - 1.0) / a0;
+  ld->highpass.a2 = (1.0 - K / Q + K * K) / a0;
+
+  /*
+   * Hann windowed sinc, cut off at the input Nyquist frequency, split in
+   * four phases.  Each phase is scaled to unity gain at DC.
+   */
+  for(p = 0; p < SND_TP_PHASES; p++) {
+    total = 0.0;
+    for(i = 0; i < SND_TP_TAPS; i++) {
+      int n = i * SND_TP_PHASES + p;
+      x = (n - (SND_TP_TAPS * SND_TP_PHASES - 1) / 2.0) / SND_TP_PHASES;
+      h = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+      h *= 0.5 - 0.5 * cos(2.0 * M_PI * (n + 0.5) / (SND_TP_TAPS * SND_TP_PHASES));
+      ld->taps[p][i] = h;
+      total += h;
+    }
+    for(i = 0; i < SND_TP_TAPS; i++) {
+      ld->taps[p][i] /= total;
+    }
+  }
+
+  return TCL_OK;
+}
+
+static double SndBiquadRun(const SndBiquad *bq, double *state, double x){
+  double y = bq->b0 * x + state[0];
+
+  state[0] = bq->b1 * x - bq->a1 * y + state[1];
+  state[1] = bq->b2 * x - bq->a2 * y;
+  return y;
+}
+
+static int SndLoudnessAdd(SndLoudness *ld, const double *frames, sf_count_t n){
+  int channels = ld->channels;
+  sf_count_t f;
+  int c, i, p, pos;
+  double x, y, v, *hist;
+
+  for(f = 0; f < n; f++) {
+    pos = ld->hpos;
+    for(c = 0; c < channels; c++) {
+      x = frames[f * channels + c];
+
+      /* Sample and true peak */
+      hist = ld->history + c * SND_TP_TAPS;
+      hist[pos] = x;
+      v = fabs(x);
+      if(v > ld->samplepeak) ld->samplepeak = v;
+      if(v > ld->truepeak) ld->truepeak = v;
+      for(p = 0; p < SND_TP_PHASES; p++) {
+        y = 0.0;
+        for(i = 0; i < SND_TP_TAPS; i++) {
+          y += ld->taps[p][i] * hist[(pos - i + SND_TP_TAPS) % SND_TP_TAPS];
+        }
+        y = fabs(y);
+        if(y > ld->truepeak) ld->truepeak = y;
+      }
+
+      /* K-weighting */
+      y = SndBiquadRun(&ld->shelf, ld->state + c * 4, x);
+      y = SndBiquadRun(&ld->highpass, ld->state + c * 4 + 2, y);
+      ld->sums[c] += y * y;
+    }
+    ld->hpos = (pos + 1) % SND_TP_TAPS;
+
+    if(++ld->counter == ld->stepframes) {
+      if(ld->nsteps == ld->allocated) {
+        size_t size = ld->allocated ? ld->allocated * 2 : 1024;
+        Tcl_WideInt nbytes = (Tcl_WideInt) (size - ld->allocated) * sizeof(double);
+        double *steps;
+
+        if(!SndMemoryCharge(nbytes)) {
+          return TCL_ERROR;
+        }
+        steps = (double *) realloc(ld->steps, size * sizeof(double));
+        if(steps == NULL) {
+          SndMemoryUncharge(nbytes);
+          return TCL_ERROR;
+        }
+        ld->charged += nbytes;
+        ld->steps = steps;
+        ld->allocated = size;
+      }
+
+      v = 0.0;
+      for(c = 0; c < channels; c++) {
+        v += ld->weights[c] * ld->sums[c] / ld->stepframes;
+        ld->sums[c] = 0.0;
+      }
+      ld->steps[ld->nsteps++] = v;
+      ld->counter = 0;
+    }
+  }
+
+  return TCL_OK;
+}
+
+static double SndEnergyToLoudness(double energy){
+  return energy > 0.0 ? -0.691 + 10.0 * log10(energy) : -HUGE_VAL;
+}
+
+static int SndCompareDouble(const void *a, const void *b){
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ * Mean energy of windows of "width" steps taken every "hop" steps, gated
+ * at -70 LUFS and then "relative" LU below the mean of the remaining
+ * windows.  For the loudness range, also return the 10th and 95th
+ * percentile of the gated windows.
+ */
+static double SndGatedLoudness(SndLoudness *ld, size_t width, size_t hop, double relative,
+                               double *range){
+  double absgate = pow(10.0, (-70.0 + 0.691) / 10.0);
+  double *energy = NULL;
+  double sum = 0.0, gate;
+  size_t count = 0, i, j, n = 0, kept = 0;
+
+  if(range) *range = 0.0;
+
+  if(ld->nsteps >= width) {
+    n = (ld->nsteps - width) / hop + 1;
+  }
+  if(n == 0) {
+    return -HUGE_VAL;
+  }
+
+  energy = (double *) malloc(n * sizeof(double));
+  if(energy == NULL) {
+    return -HUGE_VAL;
+  }
+
+  for(i = 0; i < n; i++) {
+    double e = 0.0;
+    for(j = 0; j < width; j++) {
+      e += ld->steps[i * hop + j];
+    }
+    energy[i] = e / width;
+    if(energy[i] > absgate) {
+      sum += energy[i];
+      count++;
+    }
+  }
+
+  if(count == 0) {
+    free(energy);
+    return -HUGE_VAL;
+  }
+
+  gate = sum / count * pow(10.0, relative / 10.0);
+  sum = 0.0;
+  for(i = 0; i < n; i++) {
+    if(energy[i] > absgate && energy[i] > gate) {
+      sum += energy[i];
+      energy[kept++] = energy[i];
+    }
+  }
+
+  if(range && kept > 0) {
+    qsort(energy, kept, sizeof(double), SndCompareDouble);
+    *range = SndEnergyToLoudness(energy[(size_t) ((kept - 1) * 0.95 + 0.5)]) -
+             SndEnergyToLoudness(energy[(size_t) ((kept - 1) * 0.10 + 0.5)]);
+  }
+
+  free(energy);
+  return kept ? SndEnergyToLoudness(sum / kept) : -HUGE_VAL;
+}
+
+static double SndToDecibel(double value){
+  return value > 0.0 ? 20.0 * log10(value) : -HUGE_VAL;
+}
+
+static Tcl_Obj *SndLoudnessResult(SndLoudness *ld){
+  Tcl_Obj *pResultStr = Tcl_NewListObj(0, NULL);
+  double range = 0.0;
+  double integrated;
+
+  integrated = SndGatedLoudness(ld, 4, 1, -10.0, NULL);
+  SndGatedLoudness(ld, 30, 10, -20.0, &range);
+
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("integrated", -1));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewDoubleObj(integrated));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("range", -1));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewDoubleObj(range));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("truepeak", -1));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewDoubleObj(SndToDecibel(ld->truepeak)));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("samplepeak", -1));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewDoubleObj(SndToDecibel(ld->samplepeak)));
+
+  return pResultStr;
+}
+
+/*
+ * Feed the rest of a file to the meter, "frames" frames at a time.
+ */
+static int SndLoudnessRead(SndLoudness *ld, SNDFILE *sndfile, double *block, sf_count_t frames){
+  sf_count_t n;
+
+  while((n = sf_readf_double(sndfile, block, frames)) > 0) {
+    if(SndLoudnessAdd(ld, block, n) != TCL_OK) {
+      return TCL_ERROR;
+    }
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Digests of decoded audio: XXH64, XXH3, SHA-256 and MD5.  MD5 is also
+ * used to check the signature in a FLAC STREAMINFO block.  All of them
+ * are streaming and byte order independent.
+ */
+
+enum SndDigestAlgo {
+  SND_DIGEST_XXH64,
+  SND_DIGEST_SHA256,
+  SND_DIGEST_XXH3,
+  SND_DIGEST_MD5
+};
+
+static const char *sndDigestNames[] = {
+  "xxh64", "sha256", "xxh3", "md5", 0
+};
+
+#define SND_XXH_P1 0x9E3779B185EBCA87ULL
+#define SND_XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define SND_XXH_P3 0x165667B19E3779F9ULL
+#define SND_XXH_P4 0x85EBCA77C2B2AE63ULL
+#define SND_XXH_P5 0x27D4EB2F165667C5ULL
+
+typedef unsigned int SndU32;
+
+typedef struct SndXXH64 SndXXH64;
+
+struct SndXXH64 {
+  Tcl_WideUInt v[4];
+  Tcl_WideUInt total;
+  unsigned char mem[32];
+  int used;
+};
+
+#define SND_XXH3_STRIPE 64
+#define SND_XXH3_SECRET 192
+#define SND_XXH3_BUFFER 256
+#define SND_XXH3_STRIPES_PER_BLOCK ((SND_XXH3_SECRET - SND_XXH3_STRIPE) / 8)
+
+#define SND_XXH_P32_1 0x9E3779B1U
+#define SND_XXH_P32_2 0x85EBCA77U
+#define SND_XXH_P32_3 0xC2B2AE3DU
+
+typedef struct SndXXH3 SndXXH3;
+
+struct SndXXH3 {
+  Tcl_WideUInt acc[8];
+  Tcl_WideUInt total;
+  int stripes;             /* Stripes of the current block */
+  int used;
+  unsigned char mem[SND_XXH3_BUFFER];
+};
+
+typedef struct SndSha256 SndSha256;
+
+struct SndSha256 {
+  SndU32 h[8];
+  Tcl_WideUInt total;
+  unsigned char mem[64];
+  int used;
+};
+
+typedef struct SndMd5 SndMd5;
+
+struct SndMd5 {
+  SndU32 h[4];
+  Tcl_WideUInt total;
+  unsigned char mem[64];
+  int used;
+};
+
+typedef struct SndDigest SndDigest;
+
+struct SndDigest {
+  int algo;
+  union {
+    SndXXH64 xxh;
+    SndXXH3 xxh3;
+    SndSha256 sha;
+    SndMd5 md5;
+  } u;
+};
+
+static Tcl_WideUInt SndRotl64(Tcl_WideUInt x, int r){
+  return (x << r) | (x >> (64 - r));
+}
+
+static SndU32 SndRotl32(SndU32 x, int r){
+  return (x << r) | (x >> (32 - r));
+}
+
+static SndU32 SndRotr32(SndU32 x, int r){
+  return (x >> r) | (x << (32 - r));
+}
+
+static Tcl_WideUInt SndLoad64LE(const unsigned char *p){
+  Tcl_WideUInt v = 0;
+  int i;
+
+  for(i = 7; i >= 0; i--) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+static SndU32 SndLoad32LE(const unsigned char *p){
+  return (SndU32) p[0] | ((SndU32) p[1] << 8) | ((SndU32) p[2] << 16) | ((SndU32) p[3] << 24);
+}
+
+static SndU32 SndLoad32BE(const unsigned char *p){
+  return ((SndU32) p[0] << 24) | ((SndU32) p[1] << 16) | ((SndU32) p[2] << 8) | (SndU32) p[3];
+}
+
+static Tcl_WideUInt SndXXH64Round(Tcl_WideUInt acc, Tcl_WideUInt input){
+  acc += input * SND_XXH_P2;
+  acc = SndRotl64(acc, 31);
+  return acc * SND_XXH_P1;
+}
+
+static Tcl_WideUInt SndXXH64Merge(Tcl_WideUInt h, Tcl_WideUInt v){
+  h ^= SndXXH64Round(0, v);
+  return h * SND_XXH_P1 + SND_XXH_P4;
+}
+
+static void SndXXH64Init(SndXXH64 *x){
+  memset(x, 0, sizeof(*x));
+  x->v[0] = SND_XXH_P1 + SND_XXH_P2;
+  x->v[1] = SND_XXH_P2;
+  x->v[2] = 0;
+  x->v[3] = 0 - SND_XXH_P1;
+}
+
+static void SndXXH64Stripe(SndXXH64 *x, const unsigned char *p){
+  x->v[0] = SndXXH64Round(x->v[0], SndLoad64LE(p));
+  x->v[1] = SndXXH64Round(x->v[1], SndLoad64LE(p + 8));
+  x->v[2] = SndXXH64Round(x->v[2], SndLoad64LE(p + 16));
+  x->v[3] = SndXXH64Round(x->v[3], SndLoad64LE(p + 24));
+}
+
+static void SndXXH64Update(SndXXH64 *x, const unsigned char *p, size_t len){
+  size_t n;
+
+  x->total += len;
+
+  if(x->used) {
+    n = 32 - x->used;
+    if(n > len) n = len;
+    memcpy(x->mem + x->used, p, n);
+    x->used += (int) n;
+    p += n;
+    len -= n;
+    if(x->used < 32) {
+      return;
+    }
+    SndXXH64Stripe(x, x->mem);
+    x->used = 0;
+  }
+
+  while(len >= 32) {
+    SndXXH64Stripe(x, p);
+    p += 32;
+    len -= 32;
+  }
+
+  memcpy(x->mem, p, len);
+  x->used = (int) len;
+}
+
+static void SndXXH64Final(SndXXH64 *x, unsigned char *out){
+  const unsigned char *p = x->mem;
+  int len = x->used;
+  Tcl_WideUInt h;
+  int i;
+
+  if(x->total >= 32) {
+    h = SndRotl64(x->v[0], 1) + SndRotl64(x->v[1], 7) +
+        SndRotl64(x->v[2], 12) + SndRotl64(x->v[3], 18);
+    for(i = 0; i < 4; i++) {
+      h = SndXXH64Merge(h, x->v[i]);
+    }
+  } else {
+    h = SND_XXH_P5;
+  }
+  h += x->total;
+
+  for(; len >= 8; len -= 8, p += 8) {
+    h ^= SndXXH64Round(0, SndLoad64LE(p));
+    h = SndRotl64(h, 27) * SND_XXH_P1 + SND_XXH_P4;
+  }
+  if(len >= 4) {
+    h ^= (Tcl_WideUInt) SndLoad32LE(p) * SND_XXH_P1;
+    h = SndRotl64(h, 23) * SND_XXH_P2 + SND_XXH_P3;
+    len -= 4;
+    p += 4;
+  }
+  for(; len > 0; len--, p++) {
+    h ^= *p * SND_XXH_P5;
+    h = SndRotl64(h, 11) * SND_XXH_P1;
+  }
+
+  h ^= h >> 33;
+  h *= SND_XXH_P2;
+  h ^= h >> 29;
+  h *= SND_XXH_P3;
+  h ^= h >> 32;
+
+  /* Canonical form is big endian, like xxhsum prints it */
+  for(i = 0; i < 8; i++) {
+    out[i] = (unsigned char) (h >> (56 - 8 * i));
+  }
+}
+
+/*
+ * XXH3 64 bit with seed 0 and the default secret, as in xxHash 0.8.  The
+ * input is kept in a 256 byte buffer so that inputs of up to 240 bytes
+ * can take the short paths, and the last stripe can be read again at the
+ * end.
+ */
+static const unsigned char sndXXH3Secret[SND_XXH3_SECRET] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+/*
+ * Low and high halves of the 128 bit product, xor'ed
+ */
+static Tcl_WideUInt SndMul128Fold64(Tcl_WideUInt a, Tcl_WideUInt b){
+  Tcl_WideUInt lo_lo = (a & 0xFFFFFFFFU) * (b & 0xFFFFFFFFU);
+  Tcl_WideUInt hi_lo = (a >> 32) * (b & 0xFFFFFFFFU);
+  Tcl_WideUInt lo_hi = (a & 0xFFFFFFFFU) * (b >> 32);
+  Tcl_WideUInt hi_hi = (a >> 32) * (b >> 32);
+  Tcl_WideUInt cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFU) + lo_hi;
+  Tcl_WideUInt upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  Tcl_WideUInt lower = (cross << 32) | (lo_lo & 0xFFFFFFFFU);
+
+  return lower ^ upper;
+}
+
+static Tcl_WideUInt SndXXH64Avalanche(Tcl_WideUInt h){
+  h ^= h >> 33;
+  h *= SND_XXH_P2;
+  h ^= h >> 29;
+  h *= SND_XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+static Tcl_WideUInt SndXXH3Avalanche(Tcl_WideUInt h){
+  h ^= h >> 37;
+  h *= 0x165667919E3779F9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+static Tcl_WideUInt SndXXH3Rrmxmx(Tcl_WideUInt h, Tcl_WideUInt len){
+  h ^= SndRotl64(h, 49) ^ SndRotl64(h, 24);
+  h *= 0x9FB21C651E98DF25ULL;
+  h ^= (h >> 35) + len;
+  h *= 0x9FB21C651E98DF25ULL;
+  return h ^ (h >> 28);
+}
+
+static Tcl_WideUInt SndXXH3Mix16(const unsigned char *p, const unsigned char *secret){
+  return SndMul128Fold64(SndLoad64LE(p) ^ SndLoad64LE(secret),
+                         SndLoad64LE(p + 8) ^ SndLoad64LE(secret + 8));
+}
+
+static Tcl_WideUInt SndXXH3Short(const unsigned char *p, size_t len){
+  const unsigned char *secret = sndXXH3Secret;
+  Tcl_WideUInt acc, lo, hi;
+  size_t i;
+
+  if(len == 0) {
+    return SndXXH64Avalanche(SndLoad64LE(secret + 56) ^ SndLoad64LE(secret + 64));
+  }
+
+  if(len <= 3) {
+    SndU32 combined = ((SndU32) p[0] << 16) | ((SndU32) p[len >> 1] << 24) |
+                      (SndU32) p[len - 1] | ((SndU32) len << 8);
+    return SndXXH64Avalanche((Tcl_WideUInt) combined ^
+                             (SndLoad32LE(secret) ^ SndLoad32LE(secret + 4)));
+  }
+
+  if(len <= 8) {
+    acc = SndLoad32LE(p + len - 4) + ((Tcl_WideUInt) SndLoad32LE(p) << 32);
+    return SndXXH3Rrmxmx(acc ^ (SndLoad64LE(secret + 8) ^ SndLoad64LE(secret + 16)), len);
+  }
+
+  if(len <= 16) {
+    lo = SndLoad64LE(p) ^ (SndLoad64LE(secret + 24) ^ SndLoad64LE(secret + 32));
+    hi = SndLoad64LE(p + len - 8) ^ (SndLoad64LE(secret + 40) ^ SndLoad64LE(secret + 48));
+    acc = len + ((lo >> 56) | ((lo >> 40) & 0xFF00U) | ((lo >> 24) & 0xFF0000U) |
+                 ((lo >> 8) & 0xFF000000U) | ((lo << 8) & 0xFF00000000ULL) |
+                 ((lo << 24) & 0xFF0000000000ULL) | ((lo << 40) & 0xFF000000000000ULL) |
+                 (lo << 56)) + hi + SndMul128Fold64(lo, hi);
+    return SndXXH3Avalanche(acc);
+  }
+
+  acc = len * SND_XXH_P1;
+  if(len <= 128) {
+    if(len > 32) {
+      if(len > 64) {
+        if(len > 96) {
+          acc += SndXXH3Mix16(p + 48, secret + 96);
+          acc += SndXXH3Mix16(p + len - 64, secret + 112);
+        }
+        acc += SndXXH3Mix16(p + 32, secret + 64);
+        acc += SndXXH3Mix16(p + len - 48, secret + 80);
+      }
+      acc += SndXXH3Mix16(p + 16, secret + 32);
+      acc += SndXXH3Mix16(p + len - 32, secret + 48);
+    }
+    acc += SndXXH3Mix16(p, secret);
+    acc += SndXXH3Mix16(p + len - 16, secret + 16);
+    return SndXXH3Avalanche(acc);
+  }
+
+  /* 129 to 240 bytes */
+  for(i = 0; i < 8; i++) {
+    acc += SndXXH3Mix16(p + 16 * i, secret + 16 * i);
+  }
+  acc = SndXXH3Avalanche(acc);
+  for(i = 8; i < len / 16; i++) {
+    acc += SndXXH3Mix16(p + 16 * i, secret + 16 * (i - 8) + 3);
+  }
+  acc += SndXXH3Mix16(p + len - 16, secret + 136 - 17);
+  return SndXXH3Avalanche(acc);
+}
+
+static void SndXXH3Init(SndXXH3 *x){
+  memset(x, 0, sizeof(*x));
+  x->acc[0] = SND_XXH_P32_3;
+  x->acc[1] = SND_XXH_P1;
+  x->acc[2] = SND_XXH_P2;
+  x->acc[3] = SND_XXH_P3;
+  x->acc[4] = SND_XXH_P4;
+  x->acc[5] = SND_XXH_P32_2;
+  x->acc[6] = SND_XXH_P5;
+  x->acc[7] = SND_XXH_P32_1;
+}
+
+static void SndXXH3Stripe(Tcl_WideUInt *acc, const unsigned char *p, const unsigned char *secret){
+  Tcl_WideUInt value, key;
+  int i;
+
+  for(i = 0; i < 8; i++) {
+    value = SndLoad64LE(p + 8 * i);
+    key = value ^ SndLoad64LE(secret + 8 * i);
+    acc[i ^ 1] += value;
+    acc[i] += (key & 0xFFFFFFFFU) * (key >> 32);
+  }
+}
+
+static void SndXXH3Scramble(Tcl_WideUInt *acc){
+  const unsigned char *secret = sndXXH3Secret + SND_XXH3_SECRET - SND_XXH3_STRIPE;
+  int i;
+
+  for(i = 0; i < 8; i++) {
+    acc[i] = (acc[i] ^ (acc[i] >> 47) ^ SndLoad64LE(secret + 8 * i)) * SND_XXH_P32_1;
+  }
+}
+
+/*
+ * Feed "count" stripes, scrambling the accumulators after each block
+ */
+static void SndXXH3Stripes(Tcl_WideUInt *acc, int *stripes, const unsigned char *p, int count){
+  while(count-- > 0) {
+    SndXXH3Stripe(acc, p, sndXXH3Secret + 8 * *stripes);
+    p += SND_XXH3_STRIPE;
+    if(++*stripes == SND_XXH3_STRIPES_PER_BLOCK) {
+      SndXXH3Scramble(acc);
+      *stripes = 0;
+    }
+  }
+}
+
+static void SndXXH3Update(SndXXH3 *x, const unsigned char *p, size_t len){
+  size_t n;
+
+  x->total += len;
+
+  if(len <= (size_t) (SND_XXH3_BUFFER - x->used)) {
+    memcpy(x->mem + x->used, p, len);
+    x->used += (int) len;
+    return;
+  }
+
+  /* Keep at least one byte back, the end needs the last stripe */
+  if(x->used) {
+    n = SND_XXH3_BUFFER - x->used;
+    memcpy(x->mem + x->used, p, n);
+    p += n;
+    len -= n;
+    SndXXH3Stripes(x->acc, &x->stripes, x->mem, SND_XXH3_BUFFER / SND_XXH3_STRIPE);
+    x->used = 0;
+  }
+
+  if(len > SND_XXH3_BUFFER) {
+    do {
+      SndXXH3Stripes(x->acc, &x->stripes, p, SND_XXH3_BUFFER / SND_XXH3_STRIPE);
+      p += SND_XXH3_BUFFER;
+      len -= SND_XXH3_BUFFER;
+    } while(len > SND_XXH3_BUFFER);
+    memcpy(x->mem + SND_XXH3_BUFFER - SND_XXH3_STRIPE, p - SND_XXH3_STRIPE, SND_XXH3_STRIPE);
+  }
+
+  memcpy(x->mem, p, len);
+  x->used = (int) len;
+}
+
+static void SndXXH3Final(SndXXH3 *x, unsigned char *out){
+  Tcl_WideUInt acc[8], h;
+  unsigned char last[SND_XXH3_STRIPE];
+  const unsigned char *stripe;
+  int stripes = x->stripes;
+  int i, n;
+
+  if(x->total <= 240) {
+    h = SndXXH3Short(x->mem, (size_t) x->total);
+  } else {
+    memcpy(acc, x->acc, sizeof(acc));
+    if(x->used >= SND_XXH3_STRIPE) {
+      SndXXH3Stripes(acc, &stripes, x->mem, (x->used - 1) / SND_XXH3_STRIPE);
+      stripe = x->mem + x->used - SND_XXH3_STRIPE;
+    } else {
+      /* The last stripe starts in the bytes already fed */
+      n = SND_XXH3_STRIPE - x->used;
+      memcpy(last, x->mem + SND_XXH3_BUFFER - n, n);
+      memcpy(last + n, x->mem, x->used);
+      stripe = last;
+    }
+    SndXXH3Stripe(acc, stripe, sndXXH3Secret + SND_XXH3_SECRET - SND_XXH3_STRIPE - 7);
+
+    h = x->total * SND_XXH_P1;
+    for(i = 0; i < 4; i++) {
+      h += SndMul128Fold64(acc[2 * i] ^ SndLoad64LE(sndXXH3Secret + 11 + 16 * i),
+                           acc[2 * i + 1] ^ SndLoad64LE(sndXXH3Secret + 19 + 16 * i));
+    }
+    h = SndXXH3Avalanche(h);
+  }
+
+  for(i = 0; i < 8; i++) {
+    out[i] = (unsigned char) (h >> (56 - 8 * i));
+  }
+}
+
+static const SndU32 sndSha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void SndSha256Init(SndSha256 *sha){
+  static const SndU32 init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memset(sha, 0, sizeof(*sha));
+  memcpy(sha->h, init, sizeof(init));
+}
+
+static void SndSha256Block(SndSha256 *sha, const unsigned char *p){
+  SndU32 w[64], v[8], s0, s1, t1, t2;
+  int i;
+
+  for(i = 0; i < 16; i++) {
+    w[i] = SndLoad32BE(p + 4 * i);
+  }
+  for(i = 16; i < 64; i++) {
+    s0 = SndRotr32(w[i-15], 7) ^ SndRotr32(w[i-15], 18) ^ (w[i-15] >> 3);
+    s1 = SndRotr32(w[i-2], 17) ^ SndRotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  memcpy(v, sha->h, sizeof(v));
+  for(i = 0; i < 64; i++) {
+    s1 = SndRotr32(v[4], 6) ^ SndRotr32(v[4], 11) ^ SndRotr32(v[4], 25);
+    t1 = v[7] + s1 + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sndSha256K[i] + w[i];
+    s0 = SndRotr32(v[0], 2) ^ SndRotr32(v[0], 13) ^ SndRotr32(v[0], 22);
+    t2 = s0 + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+    memmove(v + 1, v, 7 * sizeof(SndU32));
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+
+  for(i = 0; i < 8; i++) {
+    sha->h[i] += v[i];
+  }
+}
+
+static const SndU32 sndMd5K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int sndMd5R[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static void SndMd5Init(SndMd5 *md5){
+  memset(md5, 0, sizeof(*md5));
+  md5->h[0] = 0x67452301;
+  md5->h[1] = 0xefcdab89;
+  md5->h[2] = 0x98badcfe;
+  md5->h[3] = 0x10325476;
+}
+
+static void SndMd5Block(SndMd5 *md5, const unsigned char *p){
+  SndU32 w[16], a, b, c, d, f, t;
+  int i, g;
+
+  for(i = 0; i < 16; i++) {
+    w[i] = SndLoad32LE(p + 4 * i);
+  }
+
+  a = md5->h[0]; b = md5->h[1]; c = md5->h[2]; d = md5->h[3];
+  for(i = 0; i < 64; i++) {
+    if(i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if(i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    } else if(i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    t = d;
+    d = c;
+    c = b;
+    b = b + SndRotl32(a + f + sndMd5K[i] + w[g], sndMd5R[(i >> 4) * 4 + (i & 3)]);
+    a = t;
+  }
+
+  md5->h[0] += a; md5->h[1] += b; md5->h[2] += c; md5->h[3] += d;
+}
+
+/*
+ * SHA-256 and MD5 share the 64 byte block buffering and padding; only
+ * the byte order of the length differs.
+ */
+typedef void (SndBlockProc)(void *state, const unsigned char *p);
+
+static void SndBlockUpdate(void *state, SndBlockProc *proc, unsigned char *mem, int *used,
+                           Tcl_WideUInt *total, const unsigned char *p, size_t len){
+  size_t n;
+
+  *total += len;
+
+  if(*used) {
+    n = 64 - *used;
+    if(n > len) n = len;
+    memcpy(mem + *used, p, n);
+    *used += (int) n;
+    p += n;
+    len -= n;
+    if(*used < 64) {
+      return;
+    }
+    proc(state, mem);
+    *used = 0;
+  }
+
+  while(len >= 64) {
+    proc(state, p);
+    p += 64;
+    len -= 64;
+  }
+
+  memcpy(mem, p, len);
+  *used = (int) len;
+}
+
+static void SndBlockFinal(void *state, SndBlockProc *proc, unsigned char *mem, int used,
+                          Tcl_WideUInt total, int bigendian){
+  Tcl_WideUInt bits = total * 8;
+  int i;
+
+  mem[used++] = 0x80;
+  if(used > 56) {
+    memset(mem + used, 0, 64 - used);
+    proc(state, mem);
+    used = 0;
+  }
+  memset(mem + used, 0, 56 - used);
+  for(i = 0; i < 8; i++) {
+    mem[bigendian ? 63 - i : 56 + i] = (unsigned char) (bits >> (8 * i));
+  }
+  proc(state, mem);
+}
+
+static void SndSha256BlockProc(void *state, const unsigned char *p){
+  SndSha256Block((SndSha256 *) state, p);
+}
+
+static void SndMd5BlockProc(void *state, const unsigned char *p){
+  SndMd5Block((SndMd5 *) state, p);
+}
+
+static void SndMd5Update(SndMd5 *md5, const unsigned char *p, size_t len){
+  SndBlockUpdate(md5, SndMd5BlockProc, md5->mem, &md5->used, &md5->total, p, len);
+}
+
+static void SndMd5Final(SndMd5 *md5, unsigned char *out){
+  int i;
+
+  SndBlockFinal(md5, SndMd5BlockProc, md5->mem, md5->used, md5->total, 0);
+  for(i = 0; i < 16; i++) {
+    out[i] = (unsigned char) (md5->h[i / 4] >> (8 * (i % 4)));
+  }
+}
+
+static void SndDigestInit(SndDigest *digest, int algo){
+  digest->algo = algo;
+  switch(algo) {
+    case SND_DIGEST_SHA256:
+      SndSha256Init(&digest->u.sha);
+      break;
+    case SND_DIGEST_XXH3:
+      SndXXH3Init(&digest->u.xxh3);
+      break;
+    case SND_DIGEST_MD5:
+      SndMd5Init(&digest->u.md5);
+      break;
+    default:
+      SndXXH64Init(&digest->u.xxh);
+      break;
+  }
+}
+
+static void SndDigestUpdate(SndDigest *digest, const unsigned char *p, size_t len){
+  SndSha256 *sha = &digest->u.sha;
+
+  switch(digest->algo) {
+    case SND_DIGEST_SHA256:
+      SndBlockUpdate(sha, SndSha256BlockProc, sha->mem, &sha->used, &sha->total, p, len);
+      break;
+    case SND_DIGEST_XXH3:
+      SndXXH3Update(&digest->u.xxh3, p, len);
+      break;
+    case SND_DIGEST_MD5:
+      SndMd5Update(&digest->u.md5, p, len);
+      break;
+    default:
+      SndXXH64Update(&digest->u.xxh, p, len);
+      break;
+  }
+}
+
+/*
+ * Write the digest to "out" (32 bytes at most) and return its length.
+ */
+static int SndDigestFinal(SndDigest *digest, unsigned char *out){
+  SndSha256 *sha = &digest->u.sha;
+  int i;
+
+  if(digest->algo == SND_DIGEST_SHA256) {
+    SndBlockFinal(sha, SndSha256BlockProc, sha->mem, sha->used, sha->total, 1);
+    for(i = 0; i < 32; i++) {
+      out[i] = (unsigned char) (sha->h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return 32;
+  }
+
+  if(digest->algo == SND_DIGEST_MD5) {
+    SndMd5Final(&digest->u.md5, out);
+    return 16;
+  }
+
+  if(digest->algo == SND_DIGEST_XXH3) {
+    SndXXH3Final(&digest->u.xxh3, out);
+    return 8;
+  }
+
+  SndXXH64Final(&digest->u.xxh, out);
+  return 8;
+}
+
+static int SndLittleEndian(void){
+  union {
+    int i;
+    char c;
+  } u;
+
+  u.i = 1;
+  return u.c == 1;
+}
+
+static void SndSwapBytes(unsigned char *p, size_t count, int size){
+  unsigned char t;
+  size_t n;
+  int i;
+
+  for(n = 0; n < count; n++, p += size) {
+    for(i = 0; i < size / 2; i++) {
+      t = p[i];
+      p[i] = p[size - 1 - i];
+      p[size - 1 - i] = t;
+    }
+  }
+}
+
+/*
+ * Find the STREAMINFO block of a FLAC file, after an optional ID3v2 tag,
+ * and return its bits per sample and MD5 signature.  Returns 0 when the
+ * file is not FLAC or the encoder did not store a signature.
+ */
+static int SndFlacSignature(const char *path, int *bps, unsigned char *md5){
+  unsigned char head[10], info[34];
+  long skip = 0;
+  FILE *fp;
+  int i, found = 0;
+
+  fp = fopen(path, "rb");
+  if(fp == NULL) {
+    return 0;
+  }
+
+  if(fread(head, 1, 10, fp) == 10 && memcmp(head, "ID3", 3) == 0) {
+    skip = 10 + (((long) head[6] & 0x7f) << 21 | (head[7] & 0x7f) << 14 |
+                 (head[8] & 0x7f) << 7 | (head[9] & 0x7f));
+    if(head[5] & 0x10) skip += 10;
+  }
+
+  if(fseek(fp, skip, SEEK_SET) == 0 && fread(head, 1, 8, fp) == 8 &&
+     memcmp(head, "fLaC", 4) == 0 && (head[4] & 0x7f) == 0 &&
+     fread(info, 1, 34, fp) == 34) {
+    *bps = (((info[12] & 1) << 4) | (info[13] >> 4)) + 1;
+    memcpy(md5, info + 18, 16);
+    for(i = 0; i < 16; i++) {
+      if(md5[i]) found = 1;
+    }
+  }
+
+  fclose(fp);
+  return found;
+}
+
+/*
+ * Hash the decoded audio of one file as the canonical little endian
+ * stream: sample rate and channels as 32 bit integers, then the samples
+ * of "type".  With "verify", the int samples are also fed to MD5 the way
+ * FLAC does and compared with the STREAMINFO signature.
+ */
+
+typedef struct SndDigestItem SndDigestItem;
+
+struct SndDigestItem {
+  char *path;              /* Translated file name */
+  unsigned char digest[32];
+  int length;
+  int verified;            /* -1 when there is no signature to check */
+  char error[256];
+};
+
+static int SndDigestFile(SndDigestItem *item, int algo, int type, int verify){
+  SndDigest digest;
+  SndMd5 md5;
+  SNDFILE *sndfile;
+  SF_INFO sfinfo;
+  unsigned char head[8], signature[16], check[16];
+  unsigned char *block, *packed = NULL, *q;
+  SndBuffer *blockbuf = NULL, *packedbuf = NULL;
+  int little = SndLittleEndian();
+  int size = sndTypeSizes[type];
+  int bps = 0, bytes = 0, channels;
+  sf_count_t n, i;
+  int *samples;
+  int b, rc = TCL_ERROR;
+
+  item->verified = -1;
+
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  sndfile = sf_open(item->path, SFM_READ, &sfinfo);
+  if(sndfile == NULL) {
+    snprintf(item->error, sizeof(item->error), "%s", sf_strerror(NULL));
+    return TCL_ERROR;
+  }
+  channels = sfinfo.channels;
+
+  if(verify && SndFlacSignature(item->path, &bps, signature) && bps <= 32) {
+    bytes = (bps + 7) / 8;
+    SndMd5Init(&md5);
+    /* At most 4 bytes a sample, an int buffer holds them */
+    packedbuf = SndBufferAlloc(SND_TYPE_INT, channels, (sf_count_t) SND_BLOCK_FRAMES * channels);
+    if(packedbuf == NULL) {
+      goto nomem;
+    }
+    packed = (unsigned char *) packedbuf->data;
+  }
+
+  blockbuf = SndBufferAlloc(type, channels, (sf_count_t) SND_BLOCK_FRAMES * channels);
+  if(blockbuf == NULL) {
+    goto nomem;
+  }
+  block = (unsigned char *) blockbuf->data;
+
+  for(b = 0; b < 4; b++) {
+    head[b] = (unsigned char) ((SndU32) sfinfo.samplerate >> (8 * b));
+    head[4 + b] = (unsigned char) ((SndU32) channels >> (8 * b));
+  }
+  SndDigestInit(&digest, algo);
+  SndDigestUpdate(&digest, head, 8);
+
+  while((n = SndReadFrames(sndfile, type, block, SND_BLOCK_FRAMES)) > 0) {
+    if(packed) {
+      samples = (int *) block;
+      q = packed;
+      for(i = 0; i < n * channels; i++) {
+        int v = samples[i] >> (32 - bps);
+        for(b = 0; b < bytes; b++) {
+          *q++ = (unsigned char) (v >> (8 * b));
+        }
+      }
+      SndMd5Update(&md5, packed, (size_t) (q - packed));
+    }
+
+    if(!little) {
+      SndSwapBytes(block, (size_t) (n * channels), size);
+    }
+    SndDigestUpdate(&digest, block, (size_t) (n * channels * size));
+  }
+
+  item->length = SndDigestFinal(&digest, item->digest);
+  if(packed) {
+    SndMd5Final(&md5, check);
+    item->verified = memcmp(check, signature, 16) == 0;
+  }
+  rc = TCL_OK;
+  goto done;
+
+nomem:
+  snprintf(item->error, sizeof(item->error), "%s", SndAllocReason());
+
+done:
+  SndBufferRelease(blockbuf);
+  SndBufferRelease(packedbuf);
+  sf_close(sndfile);
+  return rc;
+}
+
+/*
+ * Worker threads
+ *
+ * The batch commands hand work to threads created by Tcl_CreateThread.
+ * Workers never use an interpreter: they only call libsndfile, malloc and
+ * the Tcl mutex and condition API.  When threads cannot be created the
+ * work is still done by the calling thread.
+ */
+
+typedef void (SndWorkerProc) (void *clientData);
+
+typedef struct SndWorkers SndWorkers;
+
+struct SndWorkers {
+  SndWorkerProc *proc;
+  void *clientData;
+  Tcl_ThreadId *ids;
+  int started;
+};
+
+static Tcl_ThreadCreateType SndWorkerThread(ClientData clientData){
+  SndWorkers *workers = (SndWorkers *) clientData;
+
+  workers->proc(workers->clientData);
+  TCL_THREAD_CREATE_RETURN;
+}
+
+static void SndStartWorkers(SndWorkers *workers, int nthreads, SndWorkerProc *proc, void *clientData){
+  int i;
+
+  workers->proc = proc;
+  workers->clientData = clientData;
+  workers->started = 0;
+  workers->ids = NULL;
+
+  if(nthreads <= 0) {
+    return;
+  }
+
+  workers->ids = (Tcl_ThreadId *) malloc(nthreads * sizeof(Tcl_ThreadId));
+  if(workers->ids == NULL) {
+    return;
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    if(Tcl_CreateThread(&workers->ids[workers->started], SndWorkerThread, workers,
+                        TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) == TCL_OK) {
+      workers->started++;
+    }
+  }
+}
+
+static void SndJoinWorkers(SndWorkers *workers){
+  int i, result;
+
+  for(i = 0; i < workers->started; i++) {
+    Tcl_JoinThread(workers->ids[i], &result);
+  }
+
+  free(workers->ids);
+  workers->ids = NULL;
+  workers->started = 0;
+}
+
+/*
+ * Run proc in nthreads threads, the calling thread being one of them.
+ */
+static void SndRunWorkers(int nthreads, SndWorkerProc *proc, void *clientData){
+  SndWorkers workers;
+
+  SndStartWorkers(&workers, nthreads - 1, proc, clientData);
+  proc(clientData);
+  SndJoinWorkers(&workers);
+}
+
+static int SndGetThreadsOption(Tcl_Interp *interp, Tcl_Obj *objPtr, int *threads){
+  if(Tcl_GetIntFromObj(interp, objPtr, threads) != TCL_OK) {
+    return TCL_ERROR;
+  }
+
+  if(*threads <= 0) {
+    Tcl_AppendResult(interp, "Error: threads needs > 0", (char*)0);
+    return TCL_ERROR;
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Parallel decoding
+ *
+ * A -parallel READ handle splits the file into chunks of
+ * SND_PARALLEL_FRAMES frames.  Worker threads, each with its own SNDFILE,
+ * decode chunks ahead of the reader into a ring of slots.  Chunk c always
+ * goes to slot c % nslots, so the reader takes them in order and a worker
+ * waits while the slot of the next chunk is still in use.  Slots hold the
+ * sample type of the last read; a new type, a seek or new normalisation
+ * settings start a new generation and the read-ahead is thrown away.
+ */
+
+#define SND_PARALLEL_FRAMES 65536
+
+enum SndSlotState {
+  SND_SLOT_FREE,
+  SND_SLOT_BUSY,
+  SND_SLOT_READY
+};
+
+typedef struct SndSlot SndSlot;
+
+struct SndSlot {
+  int state;
+  int generation;
+  sf_count_t chunk;
+  sf_count_t frames;       /* Decoded frames, short at the end of the file */
+  SndBuffer *buf;          /* SND_PARALLEL_FRAMES of doubles */
+};
+
+struct SndParallel {
+  Tcl_Mutex mutex;
+  Tcl_Condition cond;
+  SndWorkers workers;
+  SNDFILE **handles;       /* One per worker */
+  int nhandles;
+  int nexthandle;
+  SndSlot *slots;
+  int nslots;
+  int channels;
+  sf_count_t frames;       /* Frames in the file */
+  sf_count_t position;     /* Frame position of the reader */
+  sf_count_t next;         /* Next chunk to decode */
+  int type;                /* -1 until the first read */
+  int normfloat;
+  int normdouble;
+  int generation;
+  int stop;
+};
+
+/*
+ * Claim the next chunk and decode it with "sndfile".  Called with the
+ * mutex held, which is released while decoding.  Returns 0 when there is
+ * nothing to claim.
+ */
+static int SndParallelStep(SndParallel *par, SNDFILE *sndfile){
+  SndSlot *slot;
+  sf_count_t start, frames = 0;
+  int type = par->type;
+  int normfloat = par->normfloat;
+  int normdouble = par->normdouble;
+
+  if(type < 0 || par->next * SND_PARALLEL_FRAMES >= par->frames) {
+    return 0;
+  }
+
+  slot = &par->slots[par->next % par->nslots];
+  if(slot->state != SND_SLOT_FREE) {
+    return 0;
+  }
+
+  slot->state = SND_SLOT_BUSY;
+  slot->chunk = par->next++;
+  slot->generation = par->generation;
+  Tcl_MutexUnlock(&par->mutex);
+
+  sf_command(sndfile, SFC_SET_NORM_FLOAT, NULL, normfloat ? SF_TRUE : SF_FALSE);
+  sf_command(sndfile, SFC_SET_NORM_DOUBLE, NULL, normdouble ? SF_TRUE : SF_FALSE);
+  start = slot->chunk * SND_PARALLEL_FRAMES;
+  if(sf_seek(sndfile, start, SEEK_SET) == start) {
+    frames = SndReadFrames(sndfile, type, slot->buf->data, SND_PARALLEL_FRAMES);
+  }
+
+  Tcl_MutexLock(&par->mutex);
+  if(slot->generation == par->generation) {
+    slot->frames = frames > 0 ? frames : 0;
+    slot->state = SND_SLOT_READY;
+  } else {
+    slot->state = SND_SLOT_FREE;
+  }
+  Tcl_ConditionNotify(&par->cond);
+
+  return 1;
+}
+
+static void SndParallelWorker(void *clientData){
+  SndParallel *par = (SndParallel *) clientData;
+  SNDFILE *sndfile;
+
+  Tcl_MutexLock(&par->mutex);
+  sndfile = par->handles[par->nexthandle++];
+  while(!par->stop) {
+    if(!SndParallelStep(par, sndfile)) {
+      Tcl_ConditionWait(&par->cond, &par->mutex, NULL);
+    }
+  }
+  Tcl_MutexUnlock(&par->mutex);
+}
+
+/*
+ * Start over at "position".  Called with the mutex held.
+ */
+static void SndParallelRestart(SndParallel *par, sf_count_t position, int type){
+  int i;
+
+  par->generation++;
+  par->position = position;
+  par->next = position / SND_PARALLEL_FRAMES;
+  par->type = type;
+
+  for(i = 0; i < par->nslots; i++) {
+    if(par->slots[i].state == SND_SLOT_READY) {
+      par->slots[i].state = SND_SLOT_FREE;
+    }
+  }
+  Tcl_ConditionNotify(&par->cond);
+}
+
+static void SndParallelReset(SndParallel *par, sf_count_t position, int normfloat, int normdouble){
+  Tcl_MutexLock(&par->mutex);
+  par->normfloat = normfloat;
+  par->normdouble = normdouble;
+  SndParallelRestart(par, position, par->type);
+  Tcl_MutexUnlock(&par->mutex);
+}
+
+static sf_count_t SndParallelTell(SndParallel *par){
+  sf_count_t position;
+
+  Tcl_MutexLock(&par->mutex);
+  position = par->position;
+  Tcl_MutexUnlock(&par->mutex);
+
+  return position;
+}
+
+static sf_count_t SndParallelRead(SndParallel *par, int type, void *ptr, sf_count_t frames){
+  size_t framesize = (size_t) par->channels * sndTypeSizes[type];
+  sf_count_t got = 0;
+  sf_count_t chunk, offset, n;
+  SndSlot *slot;
+
+  Tcl_MutexLock(&par->mutex);
+  if(type != par->type) {
+    SndParallelRestart(par, par->position, type);
+  }
+
+  while(got < frames && par->position < par->frames) {
+    chunk = par->position / SND_PARALLEL_FRAMES;
+    slot = &par->slots[chunk % par->nslots];
+
+    if(slot->state != SND_SLOT_READY || slot->chunk != chunk ||
+       slot->generation != par->generation) {
+      /* Without worker threads the reader decodes by itself */
+      if(par->workers.started == 0 && SndParallelStep(par, par->handles[0])) {
+        continue;
+      }
+      Tcl_ConditionWait(&par->cond, &par->mutex, NULL);
+      continue;
+    }
+
+    offset = par->position - chunk * SND_PARALLEL_FRAMES;
+    n = slot->frames - offset;
+    if(n <= 0) {
+      /* The decoder ran out of data before the header said */
+      par->frames = par->position;
+      break;
+    }
+    if(n > frames - got) {
+      n = frames - got;
+    }
+
+    /* A READY slot is left alone by the workers until it is freed */
+    memcpy((char *) ptr + got * framesize, (char *) slot->buf->data + offset * framesize,
+           (size_t) n * framesize);
+    par->position += n;
+    got += n;
+
+    if(offset + n >= slot->frames) {
+      slot->state = SND_SLOT_FREE;
+      Tcl_ConditionNotify(&par->cond);
+    }
+  }
+  Tcl_MutexUnlock(&par->mutex);
+
+  return got;
+}
+
+static void SndParallelClose(SndParallel *par){
+  int i;
+
+  if(par == NULL) {
+    return;
+  }
+
+  Tcl_MutexLock(&par->mutex);
+  par->stop = 1;
+  Tcl_ConditionNotify(&par->cond);
+  Tcl_MutexUnlock(&par->mutex);
+  SndJoinWorkers(&par->workers);
+
+  for(i = 0; i < par->nhandles; i++) {
+    if(par->handles[i]) sf_close(par->handles[i]);
+  }
+  for(i = 0; par->slots && i < par->nslots; i++) {
+    SndBufferRelease(par->slots[i].buf);
+  }
+  free(par->handles);
+  free(par->slots);
+  Tcl_MutexFinalize(&par->mutex);
+  Tcl_ConditionFinalize(&par->cond);
+  free(par);
+}
+
+/*
+ * Open "nthreads" more handles on the translated file name "path" and
+ * start the workers.  Returns NULL when a handle cannot be opened, or
+ * when the slots cannot be allocated and then sets "error" if not NULL.
+ */
+static SndParallel *SndParallelOpen(const char *path, const SF_INFO *sfinfo, int nthreads,
+                                    const char **error){
+  SndParallel *par;
+  SF_INFO info;
+  int i;
+
+  if(error) *error = NULL;
+
+  par = (SndParallel *) calloc(1, sizeof(SndParallel));
+  if(par == NULL) {
+    if(error) *error = "malloc failed";
+    return NULL;
+  }
+
+  par->channels = sfinfo->channels;
+  par->frames = sfinfo->frames;
+  par->type = -1;
+  par->normfloat = 1;
+  par->normdouble = 1;
+  par->nhandles = nthreads;
+  par->nslots = 2 * nthreads;
+  par->handles = (SNDFILE **) calloc(par->nhandles, sizeof(SNDFILE *));
+  par->slots = (SndSlot *) calloc(par->nslots, sizeof(SndSlot));
+  if(par->handles == NULL || par->slots == NULL) {
+    SndParallelClose(par);
+    if(error) *error = "malloc failed";
+    return NULL;
+  }
+
+  for(i = 0; i < par->nslots; i++) {
+    par->slots[i].buf = SndBufferAlloc(SND_TYPE_DOUBLE, par->channels,
+                                       (sf_count_t) SND_PARALLEL_FRAMES * par->channels);
+    if(par->slots[i].buf == NULL) {
+      SndParallelClose(par);
+      if(error) *error = SndAllocError();
+      return NULL;
+    }
+  }
+
+  for(i = 0; i < par->nhandles; i++) {
+    memset(&info, 0, sizeof(info));
+    par->handles[i] = sf_open(path, SFM_READ, &info);
+    if(par->handles[i] == NULL || info.channels != par->channels) {
+      SndParallelClose(par);
+      return NULL;
+    }
+  }
+
+  SndStartWorkers(&par->workers, nthreads, SndParallelWorker, par);
+  return par;
+}
+
+/*
+ * Silence detection
+ *
+ * A frame is silent when all of its samples are below the threshold.
+ * Looking for the next loud sample takes most of the time, so it checks
+ * 16 samples at a time with a branch free inner loop that the compiler
+ * can vectorize.
+ */
+
+#define SND_SCAN_WIDTH 16
+
+/*
+ * Index of the first sample in [start, end) with |x| >= threshold, or end
+ */
+static sf_count_t SndFindLoudSample(const float *in, sf_count_t start, sf_count_t end, float threshold){
+  sf_count_t i = start;
+  int j;
+
+  for(; i + SND_SCAN_WIDTH <= end; i += SND_SCAN_WIDTH) {
+    float peak = 0.0f;
+
+    for(j = 0; j < SND_SCAN_WIDTH; j++) {
+      float v = fabsf(in[i + j]);
+      peak = v > peak ? v : peak;
+    }
+
+    if(peak >= threshold) break;
+  }
+
+  for(; i < end; i++) {
+    if(fabsf(in[i]) >= threshold) return i;
+  }
+
+  return end;
+}
+
+/*
+ * Index of the last sample in [start, end) with |x| >= threshold, or -1
+ */
+static sf_count_t SndFindLoudSampleReverse(const float *in, sf_count_t start, sf_count_t end, float threshold){
+  sf_count_t i = end;
+  int j;
+
+  for(; i - SND_SCAN_WIDTH >= start; i -= SND_SCAN_WIDTH) {
+    float peak = 0.0f;
+
+    for(j = 1; j <= SND_SCAN_WIDTH; j++) {
+      float v = fabsf(in[i - j]);
+      peak = v > peak ? v : peak;
+    }
+
+    if(peak >= threshold) break;
+  }
+
+  for(i = i - 1; i >= start; i--) {
+    if(fabsf(in[i]) >= threshold) return i;
+  }
+
+  return -1;
+}
+
+static int SndFrameIsSilent(const float *in, int channels, float threshold){
+  int i;
+
+  for(i = 0; i < channels; i++) {
+    if(fabsf(in[i]) >= threshold) return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * Index of the first frame in [start, end) whose samples are all below
+ * the threshold, or end.  Like SndFindLoudSample it checks 16 frames at
+ * a time without branches: a block can be skipped when even its quietest
+ * frame has a loud sample.
+ */
+static sf_count_t SndFindSilentFrame(const float *in, sf_count_t start, sf_count_t end,
+                                     int channels, float threshold){
+  sf_count_t i = start;
+  int j, c;
+
+  for(; i + SND_SCAN_WIDTH <= end; i += SND_SCAN_WIDTH) {
+    const float *frame = in + i * channels;
+    float quietest = HUGE_VALF;
+
+    for(j = 0; j < SND_SCAN_WIDTH; j++) {
+      float peak = 0.0f;
+
+      for(c = 0; c < channels; c++) {
+        float v = fabsf(frame[j * channels + c]);
+        peak = v > peak ? v : peak;
+      }
+      quietest = peak < quietest ? peak : quietest;
+    }
+
+    if(quietest < threshold) break;
+  }
+
+  for(; i < end; i++) {
+    if(SndFrameIsSilent(in + i * channels, channels, threshold)) return i;
+  }
+
+  return end;
+}
+
+static float SndThreshold(double dBFS){
+  return (float) pow(10.0, dBFS / 20.0);
+}
+
+/*
+ * Scan from the current position to the end and append {start end}
+ * frame ranges of silence of at least minframes frames to listPtr.
+ */
+static int SndScanSilence(SNDFILE *sndfile, int channels, float *block, sf_count_t blockframes,
+                          float threshold, sf_count_t minframes, Tcl_Obj *listPtr){
+  sf_count_t position, runStart, n, f, loud;
+  int silent = 1;
+  Tcl_Obj *range[2];
+
+  position = sf_seek(sndfile, 0, SEEK_CUR);
+  if(position < 0) position = 0;
+  runStart = position;
+
+  while((n = sf_readf_float(sndfile, block, blockframes)) > 0) {
+    f = 0;
+    while(f < n) {
+      if(silent) {
+        loud = SndFindLoudSample(block, f * channels, n * channels, threshold) / channels;
+        if(loud >= n) {
+          f = n;
+          break;
+        }
+
+        if(position + loud - runStart >= minframes) {
+          range[0] = Tcl_NewWideIntObj((Tcl_WideInt) runStart);
+          range[1] = Tcl_NewWideIntObj((Tcl_WideInt) (position + loud));
+          Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(2, range));
+        }
+        silent = 0;
+        f = loud + 1;
+      } else {
+        f = SndFindSilentFrame(block, f, n, channels, threshold);
+        if(f < n) {
+          silent = 1;
+          runStart = position + f;
+        }
+      }
+    }
+    position += n;
+  }
+
+  if(silent && position - runStart >= minframes && position > runStart) {
+    range[0] = Tcl_NewWideIntObj((Tcl_WideInt) runStart);
+    range[1] = Tcl_NewWideIntObj((Tcl_WideInt) position);
+    Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewListObj(2, range));
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * Find the first and the last+1 loud frame of a seekable file.  The end
+ * is searched backwards from the end of the file with sf_seek, so only
+ * the silent head and tail are decoded.  *first == *last when the whole
+ * file is silent.
+ */
+static int SndFindSoundRange(SNDFILE *sndfile, int channels, sf_count_t frames, float *block,
+                             sf_count_t blockframes, float threshold,
+                             sf_count_t *first, sf_count_t *last){
+  sf_count_t position = 0, n, loud, start;
+
+  *first = *last = 0;
+
+  if(sf_seek(sndfile, 0, SEEK_SET) < 0) {
+    return TCL_ERROR;
+  }
+
+  for(;;) {
+    n = sf_readf_float(sndfile, block, blockframes);
+    if(n <= 0) {
+      return TCL_OK;
+    }
+
+    loud = SndFindLoudSample(block, 0, n * channels, threshold);
+    if(loud < n * channels) {
+      *first = position + loud / channels;
+      break;
+    }
+    position += n;
+  }
+
+  for(start = frames; start > *first; ) {
+    n = start - *first < blockframes ? start - *first : blockframes;
+    start -= n;
+
+    if(sf_seek(sndfile, start, SEEK_SET) < 0) {
+      return TCL_ERROR;
+    }
+
+    n = sf_readf_float(sndfile, block, n);
+    if(n <= 0) {
+      return TCL_ERROR;
+    }
+
+    loud = SndFindLoudSampleReverse(block, 0, n * channels, threshold);
+    if(loud >= 0) {
+      *last = start + loud / channels + 1;
+      return TCL_OK;
+    }
+  }
+
+  *last = *first + 1;
+  return TCL_OK;
+}
+
+static int SndGetSilenceOptions(Tcl_Interp *interp, int objc, Tcl_Obj *const*objv,
+                                double *threshold, double *minduration){
+  const char *zArg;
+  int i;
+
+  for(i = 0; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-threshold")==0 ){
+      if(Tcl_GetDoubleFromObj(interp, objv[i+1], threshold) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else if( minduration && strcmp(zArg, "-minduration")==0 ){
+      if(Tcl_GetDoubleFromObj(interp, objv[i+1], minduration) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(*minduration <= 0) {
+        Tcl_AppendResult(interp, "Error: minduration needs > 0", (char*)0);
+        return TCL_ERROR;
+      }
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  return TCL_OK;
+}
+
+/*
+ * HANDLE spectrogram ?-fft size? ?-hop size? ?-window name? ?-mel bands?
+ *                    ?-scale name? ?-frames count? ?-file path?
+ *
+ * Read from the current position and compute one row per hop from the
+ * mix of all channels.  The rows are returned as a float sample buffer
+ * with one "channel" per column, or written to a file as raw floats so
+ * that memory stays bounded.
+ */
+static int SndSpectrogram(Tcl_Interp *interp, SndFileData *pSnd, int objc, Tcl_Obj *const*objv){
+  SndFFT fft;
+  SndBuffer *buf;
+  SndBuffer *result = NULL;
+  Tcl_Channel chan = NULL;
+  Tcl_Obj *fileObj = NULL;
+  const char *zArg;
+  float *input = NULL;
+  float *row = NULL;
+  float *block;
+  int size = 1024;
+  int hop = 256;
+  int window = SND_WINDOW_HANN;
+  int scale = SND_SCALE_POWER;
+  int bands = 0;
+  Tcl_WideInt limit = -1;
+  int channels = pSnd->sfinfo.channels;
+  int columns, filled = 0;
+  sf_count_t blockframes, n, f, done = 0, rows = 0, maxrows, position;
+  Tcl_WideInt charged = 0;
+  int i, c;
+  int rc = TCL_ERROR;
+
+  if( objc < 2 || (objc&1)!=0 ){
+    Tcl_WrongNumArgs(interp, 2, objv,
+      "?-fft size? ?-hop size? ?-window window? ?-mel bands? ?-scale scale? ?-frames count? ?-file path?");
+    return TCL_ERROR;
+  }
+
+  for(i = 2; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-fft")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &size) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(size < 4 || (size & (size - 1)) != 0) {
+        Tcl_AppendResult(interp, "Error: fft needs a power of 2 >= 4", (char*)0);
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-hop")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &hop) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(hop <= 0) {
+        Tcl_AppendResult(interp, "Error: hop needs > 0", (char*)0);
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-window")==0 ){
+      if( Tcl_GetIndexFromObj(interp, objv[i+1], sndWindowNames, "window", 0, &window) ){
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-scale")==0 ){
+      if( Tcl_GetIndexFromObj(interp, objv[i+1], sndScaleNames, "scale", 0, &scale) ){
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-mel")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &bands) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(bands < 0) {
+        Tcl_AppendResult(interp, "Error: mel needs >= 0", (char*)0);
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-frames")==0 ){
+      if(Tcl_GetWideIntFromObj(interp, objv[i+1], &limit) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-file")==0 ){
+      fileObj = objv[i+1];
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
+    Tcl_AppendResult(interp, "Error: spectrogram needs READ or RDWR mode", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(hop > size) {
+    Tcl_AppendResult(interp, "Error: hop needs <= fft", (char*)0);
+    return TCL_ERROR;
+  }
+
+  buf = SndGetBlock(pSnd, SND_TYPE_FLOAT);
+  if( buf == 0 ){
+    Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+    return TCL_ERROR;
+  }
+
+  blockframes = buf->capacity / channels;
+  if(blockframes == 0) {
+    Tcl_AppendResult(interp, "Error: buffersize needs >= channels", (char*)0);
+    return TCL_ERROR;
+  }
+  block = (float *) buf->data;
+
+  /*
+   * The rows kept in memory are allocated once, for the frames left in
+   * the file or -frames.  When neither is known, the rows have to go to
+   * a -file.
+   */
+  maxrows = 0;
+  if(fileObj == NULL) {
+    position = pSnd->sfinfo.seekable ? sf_seek(pSnd->sndfile, 0, SEEK_CUR) : -1;
+    if(position >= 0 && (limit < 0 || pSnd->sfinfo.frames - position < limit)) {
+      limit = pSnd->sfinfo.frames - position;
+    }
+
+    if(limit < 0) {
+      Tcl_AppendResult(interp, "Error: spectrogram needs -frames or -file when the length is not known",
+                       (char*)0);
+      return TCL_ERROR;
+    }
+
+    if(limit >= size) {
+      maxrows = (limit - size) / hop + 1;
+    }
+  }
+
+  columns = bands ? bands : size / 2 + 1;
+  memset(&fft, 0, sizeof(fft));
+
+  /* The FFT tables, the input window and the row count in the budget */
+  if(!SndMemoryCharge(SndFFTBytes(size, bands) + (Tcl_WideInt) (size + columns) * sizeof(float))) {
+    Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+    goto done;
+  }
+  charged = SndFFTBytes(size, bands) + (Tcl_WideInt) (size + columns) * sizeof(float);
+
+  if(SndFFTInit(&fft, size, window) != TCL_OK ||
+     (bands > 0 && SndMelInit(&fft, bands, pSnd->sfinfo.samplerate) != TCL_OK)) {
+    Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+    goto done;
+  }
+
+  input = (float *) malloc(size * sizeof(float));
+  if(input == NULL) {
+    Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+    goto done;
+  }
+
+  if(fileObj) {
+    chan = Tcl_FSOpenFileChannel(interp, fileObj, "w", 0666);
+    if(chan == NULL) {
+      goto done;
+    }
+    Tcl_SetChannelOption(interp, chan, "-translation", "binary");
+
+    row = (float *) malloc(columns * sizeof(float));
+    if(row == NULL) {
+      Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+      goto done;
+    }
+  } else {
+    result = SndBufferAlloc(SND_TYPE_FLOAT, columns, maxrows * columns);
+    if(result == NULL) {
+      Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+      goto done;
+    }
+  }
+
+  while(limit < 0 || done < limit) {
+    n = blockframes;
+    if(limit >= 0 && limit - done < n) {
+      n = limit - done;
+    }
+
+    n = sf_readf_float(pSnd->sndfile, block, n);
+    if(n <= 0) {
+      break;
+    }
+    done += n;
+
+    for(f = 0; f < n; f++) {
+      float v = 0.0f;
+
+      for(c = 0; c < channels; c++) {
+        v += block[f * channels + c];
+      }
+      input[filled++] = v / channels;
+
+      if(filled < size) {
+        continue;
+      }
+
+      SndFFTPower(&fft, input);
+
+      if(chan) {
+        SndSpectrumRow(&fft, scale, row);
+        if(Tcl_WriteRaw(chan, (const char *) row, columns * sizeof(float)) < 0) {
+          Tcl_AppendResult(interp, "Error: ", Tcl_ErrnoMsg(Tcl_GetErrno()), (char*)0);
+          goto done;
+        }
+      } else {
+        if(result->items + columns > result->capacity) {
+          break;
+        }
+
+        SndSpectrumRow(&fft, scale, (float *) result->data + result->items);
+        result->items += columns;
+      }
+      rows++;
+
+      memmove(input, input + hop, (size - hop) * sizeof(float));
+      filled = size - hop;
+    }
+  }
+
+  if(chan) {
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) rows));
+  } else {
+    Tcl_SetObjResult(interp, SndBufferNewObj(result));
+  }
+  rc = TCL_OK;
+
+done:
+  if(chan && Tcl_Close(interp, chan) != TCL_OK) {
+    rc = TCL_ERROR;
+  }
+  SndBufferRelease(result);
+  SndFFTFree(&fft);
+  free(input);
+  free(row);
+  SndMemoryUncharge(charged);
+
+  return rc;
+}
+
+/*
+ * Event loop callbacks
+ *
+ * onchunk starts a thread that decodes chunks ahead into a small queue,
+ * onwritable starts a thread that encodes the blocks queued by write_*.
+ * Either thread owns the SNDFILE while it runs, so the other subcommands
+ * that use it are refused.  The thread wakes the interpreter thread with
+ * Tcl_ThreadQueueEvent; at most one event is pending at a time, and each
+ * event runs the script once so that other events get their turn.
+ */
+
+#define SND_ASYNC_DEPTH 4
+
+typedef struct SndRequest SndRequest;
+
+struct SndRequest {
+  int type;
+  sf_count_t items;
+  SndBuffer *buf;          /* Copy of the data, counted in the budget */
+};
+
+struct SndAsync {
+  Tcl_Mutex mutex;
+  Tcl_Condition cond;
+  SndFileData *pSnd;
+  Tcl_ThreadId owner;      /* Thread of the interpreter */
+  Tcl_ThreadId thread;
+  Tcl_Obj *script;
+  int writing;             /* onwritable rather than onchunk */
+  int stop;
+  int paused;
+  int eventPending;
+  int head;                /* Ring of chunks or requests */
+  int count;
+
+  /* onchunk */
+  int type;
+  sf_count_t frames;
+  SndBuffer *chunks[SND_ASYNC_DEPTH];
+  int eof;
+
+  /* onwritable */
+  SndRequest requests[SND_ASYNC_DEPTH];
+  SndBuffer *scratch;      /* Int block of the writer thread for -dither */
+  char error[256];
+};
+
+typedef struct SndAsyncEvent SndAsyncEvent;
+
+struct SndAsyncEvent {
+  Tcl_Event header;
+  SndFileData *pSnd;
+};
+
+static int SndAsyncEventProc(Tcl_Event *evPtr, int flags);
+
+/*
+ * Queue an event for the interpreter thread.  Called with the mutex held.
+ */
+static void SndAsyncPost(SndAsync *async){
+  SndAsyncEvent *ev;
+
+  if(async->eventPending || async->paused || async->stop) {
+    return;
+  }
+
+  async->eventPending = 1;
+  ev = (SndAsyncEvent *) Tcl_Alloc(sizeof(SndAsyncEvent));
+  ev->header.proc = SndAsyncEventProc;
+  ev->pSnd = async->pSnd;
+  Tcl_ThreadQueueEvent(async->owner, (Tcl_Event *) ev, TCL_QUEUE_TAIL);
+  Tcl_ThreadAlert(async->owner);
+}
+
+static Tcl_ThreadCreateType SndAsyncReader(ClientData clientData){
+  SndAsync *async = (SndAsync *) clientData;
+  SndFileData *pSnd = async->pSnd;
+  int channels = pSnd->sfinfo.channels;
+  SndBuffer *buf;
+  sf_count_t n;
+
+  Tcl_MutexLock(&async->mutex);
+  while(!async->stop && !async->eof) {
+    if(async->count == SND_ASYNC_DEPTH) {
+      Tcl_ConditionWait(&async->cond, &async->mutex, NULL);
+      continue;
+    }
+    Tcl_MutexUnlock(&async->mutex);
+
+    n = 0;
+    buf = SndBufferAlloc(async->type, channels, async->frames * channels);
+    if(buf && pSnd->parallel) {
+      n = SndParallelRead(pSnd->parallel, async->type, buf->data, async->frames);
+    } else if(buf) {
+      n = SndReadFrames(pSnd->sndfile, async->type, buf->data, async->frames);
+    }
+
+    Tcl_MutexLock(&async->mutex);
+    if(buf == NULL) {
+      snprintf(async->error, sizeof(async->error), "%s", SndAllocError());
+      async->eof = 1;
+    } else if(n <= 0) {
+      SndBufferRelease(buf);
+      async->eof = 1;
+    } else {
+      buf->items = n * channels;
+      async->chunks[(async->head + async->count) % SND_ASYNC_DEPTH] = buf;
+      async->count++;
+    }
+    SndAsyncPost(async);
+  }
+  Tcl_MutexUnlock(&async->mutex);
+
+  TCL_THREAD_CREATE_RETURN;
+}
+
+static Tcl_ThreadCreateType SndAsyncWriter(ClientData clientData){
+  SndAsync *async = (SndAsync *) clientData;
+  SndRequest *req;
+  sf_count_t n;
+  int failed;
+
+  Tcl_MutexLock(&async->mutex);
+  for(;;) {
+    while(async->count == 0 && !async->stop) {
+      Tcl_ConditionWait(&async->cond, &async->mutex, NULL);
+    }
+    if(async->count == 0) {
+      break;
+    }
+
+    /* The request stays counted until it is written */
+    req = &async->requests[async->head];
+    failed = async->error[0] != 0;
+    Tcl_MutexUnlock(&async->mutex);
+
+    /* After an error the rest of the queue is dropped */
+    n = failed ? req->items : SndWriteItems(async->pSnd, req->type,
+                                            (unsigned char *) req->buf->data, req->items,
+                                            async->scratch);
+    SndBufferRelease(req->buf);
+
+    Tcl_MutexLock(&async->mutex);
+    if(n == -2 && async->error[0] == 0) {
+      snprintf(async->error, sizeof(async->error), "%s", SndAllocError());
+    } else if(n != req->items && async->error[0] == 0) {
+      snprintf(async->error, sizeof(async->error), "Error: %s",
+               n < 0 ? "buffersize needs >= channels" : sf_strerror(async->pSnd->sndfile));
+    }
+    async->head = (async->head + 1) % SND_ASYNC_DEPTH;
+    async->count--;
+    Tcl_ConditionNotify(&async->cond);
+    SndAsyncPost(async);
+  }
+  Tcl_MutexUnlock(&async->mutex);
+
+  TCL_THREAD_CREATE_RETURN;
+}
+
+static int SndAsyncDeleteProc(Tcl_Event *evPtr, ClientData clientData){
+  return evPtr->proc == SndAsyncEventProc && ((SndAsyncEvent *) evPtr)->pSnd == clientData;
+}
+
+/*
+ * Stop the thread, after the queued writes are done, and forget pending
+ * events.  Returns the first write error, if any, in "error".
+ */
+static void SndAsyncStop(SndFileData *pSnd, char *error, size_t size){
+  SndAsync *async = pSnd->async;
+  int result, i;
+
+  if(error && size > 0) {
+    error[0] = 0;
+  }
+
+  if(async == NULL) {
+    return;
+  }
+
+  Tcl_MutexLock(&async->mutex);
+  async->stop = 1;
+  Tcl_ConditionNotify(&async->cond);
+  Tcl_MutexUnlock(&async->mutex);
+  Tcl_JoinThread(async->thread, &result);
+
+  if(error && size > 0) {
+    snprintf(error, size, "%s", async->error);
+  }
+
+  if(!async->writing) {
+    for(i = 0; i < async->count; i++) {
+      SndBufferRelease(async->chunks[(async->head + i) % SND_ASYNC_DEPTH]);
+    }
+  }
+
+  SndBufferRelease(async->scratch);
+  Tcl_DeleteEvents(SndAsyncDeleteProc, pSnd);
+  Tcl_DecrRefCount(async->script);
+  Tcl_MutexFinalize(&async->mutex);
+  Tcl_ConditionFinalize(&async->cond);
+  free(async);
+  pSnd->async = NULL;
+}
+
+static int SndAsyncStart(Tcl_Interp *interp, SndFileData *pSnd, int writing, int type,
+                         sf_count_t frames, Tcl_Obj *script){
+  SndAsync *async;
+
+  async = (SndAsync *) calloc(1, sizeof(SndAsync));
+  if(async == NULL) {
+    Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+    return TCL_ERROR;
+  }
+
+  async->pSnd = pSnd;
+  async->owner = Tcl_GetCurrentThread();
+  async->writing = writing;
+  async->type = type;
+  async->frames = frames;
+
+  /* The writer does not touch the blocks of the handle, they belong to
+   * the interpreter thread */
+  if(writing && pSnd->ditherbits > 0) {
+    async->scratch = SndBufferAllocFit(SND_TYPE_INT, pSnd->sfinfo.channels,
+                                       pSnd->buffersize > 0 ? pSnd->buffersize
+                                       : SndDefaultBufferSize(&pSnd->sfinfo),
+                                       pSnd->sfinfo.channels);
+    if(async->scratch == NULL) {
+      free(async);
+      Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  async->script = script;
+  Tcl_IncrRefCount(script);
+  pSnd->async = async;
+
+  if(Tcl_CreateThread(&async->thread, writing ? SndAsyncWriter : SndAsyncReader, async,
+                      TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE) != TCL_OK) {
+    Tcl_DecrRefCount(script);
+    SndBufferRelease(async->scratch);
+    free(async);
+    pSnd->async = NULL;
+    Tcl_AppendResult(interp, "Error: cannot start the background thread", (char*)0);
+    return TCL_ERROR;
+  }
+
+  /* There is room to write right away */
+  if(writing) {
+    Tcl_MutexLock(&async->mutex);
+    SndAsyncPost(async);
+    Tcl_MutexUnlock(&async->mutex);
+  }
+
+  return TCL_OK;
+}
+
+static int SndAsyncWrite(Tcl_Interp *interp, SndFileData *pSnd, int type,
+                         const unsigned char *data, sf_count_t items){
+  SndAsync *async = pSnd->async;
+  SndRequest *req;
+  SndBuffer *copy;
+
+  /* The copy is a sample buffer so that the budget sees it */
+  copy = SndBufferAlloc(type, pSnd->sfinfo.channels, items);
+  if(copy == NULL) {
+    Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+    return TCL_ERROR;
+  }
+  memcpy(copy->data, data, (size_t) items * sndTypeSizes[type]);
+  copy->items = items;
+
+  /* Only blocks when the queue is full */
+  Tcl_MutexLock(&async->mutex);
+  while(async->count == SND_ASYNC_DEPTH) {
+    Tcl_ConditionWait(&async->cond, &async->mutex, NULL);
+  }
+  req = &async->requests[(async->head + async->count) % SND_ASYNC_DEPTH];
+  req->type = type;
+  req->items = items;
+  req->buf = copy;
+  async->count++;
+  Tcl_ConditionNotify(&async->cond);
+  Tcl_MutexUnlock(&async->mutex);
+
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) items));
+  return TCL_OK;
+}
+
+static void SndAsyncEval(Tcl_Interp *interp, Tcl_Obj *script, Tcl_Obj *arg){
+  Tcl_Obj *cmd = script;
+  int result;
+
+  if(arg) {
+    cmd = Tcl_DuplicateObj(script);
+    Tcl_ListObjAppendElement(NULL, cmd, arg);
+  }
+
+  Tcl_Preserve(interp);
+  Tcl_IncrRefCount(cmd);
+  result = Tcl_EvalObjEx(interp, cmd, TCL_EVAL_GLOBAL);
+  if(result != TCL_OK) {
+    Tcl_BackgroundException(interp, result);
+  }
+  Tcl_DecrRefCount(cmd);
+  Tcl_Release(interp);
+}
+
+/*
+ * The script may close the handle or stop the callbacks, so pSnd and
+ * async are not touched after it runs.
+ */
+static int SndAsyncEventProc(Tcl_Event *evPtr, int flags){
+  SndFileData *pSnd = ((SndAsyncEvent *) evPtr)->pSnd;
+  SndAsync *async = pSnd->async;
+  Tcl_Interp *interp = pSnd->interp;
+  SndBuffer *buf = NULL;
+  Tcl_Obj *script, *arg;
+  char error[256];
+
+  if(!(flags & TCL_FILE_EVENTS)) {
+    return 0;
+  }
+
+  Tcl_MutexLock(&async->mutex);
+  async->eventPending = 0;
+  if(async->paused) {
+    Tcl_MutexUnlock(&async->mutex);
+    return 1;
+  }
+
+  if(async->writing) {
+    if(async->error[0]) {
+      snprintf(error, sizeof(error), "%s", async->error);
+      async->error[0] = 0;
+      Tcl_MutexUnlock(&async->mutex);
+      Tcl_SetObjResult(interp, Tcl_NewStringObj(error, -1));
+      Tcl_BackgroundException(interp, TCL_ERROR);
+      return 1;
+    }
+
+    if(async->count == SND_ASYNC_DEPTH) {
+      Tcl_MutexUnlock(&async->mutex);
+      return 1;
+    }
+
+    /* Like a writable fileevent, fire again as long as there is room */
+    SndAsyncPost(async);
+    script = async->script;
+    Tcl_IncrRefCount(script);
+    Tcl_MutexUnlock(&async->mutex);
+
+    SndAsyncEval(interp, script, NULL);
+    Tcl_DecrRefCount(script);
+    return 1;
+  }
+
+  if(async->count > 0) {
+    buf = async->chunks[async->head];
+    async->head = (async->head + 1) % SND_ASYNC_DEPTH;
+    async->count--;
+    Tcl_ConditionNotify(&async->cond);
+    if(async->count > 0 || async->eof) {
+      SndAsyncPost(async);
+    }
+  } else if(!async->eof) {
+    Tcl_MutexUnlock(&async->mutex);
+    return 1;
+  }
+  script = async->script;
+  Tcl_IncrRefCount(script);
+  Tcl_MutexUnlock(&async->mutex);
+
+  if(buf == NULL) {
+    /*
+     * End of the file: stop, then hand the script an empty buffer.  A
+     * chunk that could not be allocated ends the stream early and is
+     * reported as a background error.
+     */
+    buf = SndBufferAlloc(async->type, pSnd->sfinfo.channels, 0);
+    SndAsyncStop(pSnd, error, sizeof(error));
+    if(error[0]) {
+      Tcl_SetObjResult(interp, Tcl_NewStringObj(error, -1));
+      Tcl_BackgroundException(interp, TCL_ERROR);
+    }
+    if(buf == NULL) {
+      Tcl_DecrRefCount(script);
+      return 1;
+    }
+  }
+
+  arg = SndBufferNewObj(buf);
+  SndBufferRelease(buf);
+  SndAsyncEval(interp, script, arg);
+  Tcl_DecrRefCount(script);
+
+  return 1;
+}
+
+/*
+ * Close the SNDFILE of a handle, after the queued background writes, and
+ * return the result of sf_close.
+ */
+static int SndCloseFile(SndFileData *pSnd){
+  int result = 0;
+
+  SndAsyncStop(pSnd, NULL, 0);
+  if(pSnd->sndfile) {
+    result = sf_close(pSnd->sndfile);
+  }
+  if(pSnd->followfile && pSnd->followfile->header == pSnd->sndfile) {
+    pSnd->followfile->header = NULL;
+  }
+  pSnd->sndfile = NULL;
+
+  return result;
+}
+
+/*
+ * Delete proc of a handle command: runs on close, on rename to {}, when
+ * the name is reused and when the interpreter is deleted.
+ */
+static void SndDeleteCmd(ClientData clientData){
+  SndFileData *pSnd = (SndFileData *) clientData;
+
+  SndCloseFile(pSnd);
+  SndFollowClose(pSnd);
+
+  SndParallelClose(pSnd->parallel);
+  SndMemFree(pSnd->memfile);
+  free(pSnd->ditherstate);
+  free(pSnd->ditherpending);
+  SndFreeBlocks(pSnd);
+  SndFollowStop(pSnd);
+  if(pSnd->pathObj) {
+    Tcl_DecrRefCount(pSnd->pathObj);
+  }
+  /* A read_* in follow mode may still be waiting on this handle */
+  Tcl_EventuallyFree((ClientData) pSnd, TCL_DYNAMIC);
+
+  Tcl_MutexLock(&myMutex);
+  sndMemory.handles--;
+  Tcl_MutexUnlock(&myMutex);
+}
+
+static int SndObjCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndFileData *pSnd = (SndFileData *) cd;
+  int choice;
+  int rc = TCL_OK;
+
+  static const char *SND_strs[] = {
+    "buffersize",
+    "read_short",
+    "read_int",
+    "read_float",
+    "read_double",
+    "write_short",
+    "write_int",
+    "write_float",
+    "write_double",
+    "seek",
+    "tell",
+    "get_string",
+    "set_string",
+    "configure",
+    "update_header",
+    "refresh",
+    "onavailable",
+    "drain",
+    "find_silence",
+    "spectrogram",
+    "loudness",
+    "onchunk",
+    "onwritable",
+    "pause",
+    "resume",
+    "memory",
+    "close", 
+    0
+  };
+
+  enum SND_enum {
+    SND_BUFFERSIZE,
+    SND_READ_SHORT,
+    SND_READ_INT,
+    SND_READ_FLOAT,
+    SND_READ_DOUBLE,
+    SND_WRITE_SHORT,
+    SND_WRITE_INT,
+    SND_WRITE_FLOAT,
+    SND_WRITE_DOUBLE,
+    SND_SEEK,
+    SND_TELL,
+    SND_GET_STRING,
+    SND_SET_STRING,
+    SND_CONFIGURE,
+    SND_UPDATE_HEADER,
+    SND_REFRESH,
+    SND_ONAVAILABLE,
+    SND_DRAIN,
+    SND_FIND_SILENCE,
+    SND_SPECTROGRAM,
+    SND_LOUDNESS,
+    SND_ONCHUNK,
+    SND_ONWRITABLE,
+    SND_PAUSE,
+    SND_RESUME,
+    SND_MEMORY,
+    SND_CLOSE,
+  };
+
+  if( objc < 2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
+    return TCL_ERROR;
+  }
+
+  if( Tcl_GetIndexFromObj(interp, objv[1], SND_strs, "option", 0, &choice) ){
+    return TCL_ERROR;
+  }
+
+  /*
+   * While a background thread owns the SNDFILE, only the callback
+   * commands, close and (for onwritable) write_* are allowed.
+   */
+  if(pSnd->async && choice != SND_ONCHUNK && choice != SND_ONWRITABLE &&
+     choice != SND_PAUSE && choice != SND_RESUME && choice != SND_CLOSE &&
+     !(pSnd->async->writing && choice >= SND_WRITE_SHORT && choice <= SND_WRITE_DOUBLE)) {
+    Tcl_AppendResult(interp, "Error: the handle is busy with onchunk or onwritable", (char*)0);
+    return TCL_ERROR;
+  }
+
+  /*
+   * Commands that use the handle's own SNDFILE start at the reader
+   * position of a -parallel handle, and the reader continues from where
+   * they leave it.  The frames read ahead are only dropped when the
+   * position or a -norm* setting changed; configure queries go through.
+   */
+  if(pSnd->parallel && (choice == SND_SEEK || (choice == SND_CONFIGURE && objc > 3) ||
+     choice == SND_FIND_SILENCE || choice == SND_SPECTROGRAM || choice == SND_LOUDNESS)) {
+    SndParallel *par = pSnd->parallel;
+    sf_count_t position = SndParallelTell(par);
+    int normfloat = pSnd->config.normfloat;
+    int normdouble = pSnd->config.normdouble;
+
+    sf_seek(pSnd->sndfile, position, SEEK_SET);
+    pSnd->parallel = NULL;
+    rc = SndObjCmd(cd, interp, objc, objv);
+    pSnd->parallel = par;
+    if(sf_seek(pSnd->sndfile, 0, SEEK_CUR) != position ||
+       pSnd->config.normfloat != normfloat || pSnd->config.normdouble != normdouble) {
+      SndParallelReset(par, sf_seek(pSnd->sndfile, 0, SEEK_CUR),
+                       pSnd->config.normfloat, pSnd->config.normdouble);
+    }
+    return rc;
+  }
+
+  /*
+   * After "drain -final" only drain and close are allowed.
+   */
+  if(pSnd->sndfile == NULL && choice != SND_DRAIN && choice != SND_CLOSE) {
+    Tcl_AppendResult(interp, "Error: the encoder is already finished", (char*)0);
+    return TCL_ERROR;
+  }
+
+  switch( (enum SND_enum)choice ){
+
+    case SND_BUFFERSIZE: {
+      int buffersize = 0;
+
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "size");
+        return TCL_ERROR;
+      }
+
+      if(Tcl_GetIntFromObj(interp, objv[2], &buffersize) != TCL_OK) {
+         return TCL_ERROR;
+      }
+
+      if(buffersize <= 0) {
+         Tcl_AppendResult(interp, "Error: buffersize needs > 0", (char*)0);
+         return TCL_ERROR;
+      }
+
+      Tcl_MutexLock(&myMutex);
+      if(pSnd->buff_init == 0) {
+        pSnd->buffersize = buffersize;
+        pSnd->buff_init = 1;
+      }
+      Tcl_MutexUnlock(&myMutex);
+      break;
+    }
+
+    case SND_READ_SHORT: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      rc = SndReadBlock(interp, pSnd, SND_TYPE_SHORT);
+      break;
+    }
+
+    case SND_READ_INT: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      rc = SndReadBlock(interp, pSnd, SND_TYPE_INT);
+      break;
+    }
+
+    case SND_READ_FLOAT: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      rc = SndReadBlock(interp, pSnd, SND_TYPE_FLOAT);
+      break;
+    }
+
+    case SND_READ_DOUBLE: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      rc = SndReadBlock(interp, pSnd, SND_TYPE_DOUBLE);
+      break;
+    }
+
+    case SND_WRITE_SHORT: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "byte_array"
+        );
+        return TCL_ERROR;
+      }
+
+      rc = SndWriteBlock(interp, pSnd, SND_TYPE_SHORT, objv[2]);
+      break;
+    }
+
+    case SND_WRITE_INT: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "byte_array"
+        );
+        return TCL_ERROR;
+      }
+
+      rc = SndWriteBlock(interp, pSnd, SND_TYPE_INT, objv[2]);
+      break;
+    }
+
+    case SND_WRITE_FLOAT: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "byte_array"
+        );
+        return TCL_ERROR;
+      }
+
+      rc = SndWriteBlock(interp, pSnd, SND_TYPE_FLOAT, objv[2]);
+      break;
+    }
+
+    case SND_WRITE_DOUBLE: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "byte_array"
+        );
+        return TCL_ERROR;
+      }
+
+      rc = SndWriteBlock(interp, pSnd, SND_TYPE_DOUBLE, objv[2]);
+      break;
+    }
+
+    case SND_SEEK: {
+      Tcl_Obj *return_obj = NULL;
+      Tcl_WideInt location = 0;
+      const char *pWhence = NULL;
+      int whence = SEEK_CUR;
+      Tcl_Size len;
+      sf_count_t count;
+
+      if( objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "location whence"
+        );
+        return TCL_ERROR;
+      }
+
+      if(pSnd->sfinfo.seekable) {
+        if(Tcl_GetWideIntFromObj(interp, objv[2], &location) != TCL_OK) {
+            return TCL_ERROR;
+        }
+
+        pWhence = Tcl_GetStringFromObj(objv[3], &len);
+        if( !pWhence || len < 1 ){
+            return TCL_ERROR;
+        }
+
+        //SEEK_SET  - set to the start of the audio data plus offset
+        //SEEK_CUR  - set to its current location plus offset 
+        //SEEK_END  - set to the end of the data plus offset
+        if( strcmp(pWhence, "SET")==0 ){
+          whence = SEEK_SET;
+        } else if( strcmp(pWhence, "CUR")==0 ){
+          whence = SEEK_CUR;
+        } else if( strcmp(pWhence, "END")==0 ){
+          whence = SEEK_END;
+        }
+
+        count = sf_seek(pSnd->sndfile, (sf_count_t) location, whence);
+
+        return_obj = Tcl_NewWideIntObj((Tcl_WideInt) count);
+        Tcl_SetObjResult(interp, return_obj);
+      } else {
+          Tcl_SetResult(interp, (char *)"Not seekable", TCL_STATIC);
+          return TCL_ERROR;
+      }
+      break;
+    }
+
+    case SND_TELL: {
+      sf_count_t count;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      /*
+       * sf_seek with an offset of zero from SEEK_CUR returns the current
+       * position and works on files that are not seekable.
+       */
+      if(pSnd->parallel) {
+        count = SndParallelTell(pSnd->parallel);
+      } else {
+        count = sf_seek(pSnd->sndfile, 0, SEEK_CUR);
+      }
+      if(count < 0) {
+        Tcl_AppendResult(interp, "Error: ", sf_strerror(pSnd->sndfile), (char*)0);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) count));
+      break;
+    }
+
+    case SND_GET_STRING: {
+      Tcl_Obj *return_obj = NULL;
+      const char *pType = NULL;
+      const char *pResult = NULL;
+      int str_type = 0;
+      Tcl_Size len = 0;
+
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "str_type"
+        );
+        return TCL_ERROR;
+      }
+
+      pType = Tcl_GetStringFromObj(objv[2], &len);
+      if( !pType || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
+        return TCL_ERROR;
+      }
+
+      if( strcmp(pType, "SF_STR_TITLE")==0 ){
+        str_type = SF_STR_TITLE;
+      } else if( strcmp(pType, "SF_STR_COPYRIGHT")==0 ){
+        str_type = SF_STR_COPYRIGHT;
+      } else if( strcmp(pType, "SF_STR_SOFTWARE")==0 ){
+        str_type = SF_STR_SOFTWARE;
+      } else if( strcmp(pType, "SF_STR_ARTIST")==0 ){
+        str_type = SF_STR_ARTIST;
+      } else if( strcmp(pType, "SF_STR_COMMENT")==0 ){
+        str_type = SF_STR_COMMENT;
+      } else if( strcmp(pType, "SF_STR_DATE")==0 ){
+        str_type = SF_STR_DATE;
+      } else if( strcmp(pType, "SF_STR_ALBUM")==0 ){
+        str_type = SF_STR_ALBUM;
+      } else if( strcmp(pType, "SF_STR_LICENSE")==0 ){
+        str_type = SF_STR_LICENSE;
+      } else if( strcmp(pType, "SF_STR_TRACKNUMBER")==0 ){
+        str_type = SF_STR_TRACKNUMBER;
+      } else if( strcmp(pType, "SF_STR_GENRE")==0 ){
+        str_type = SF_STR_GENRE;
+      } else {
+        Tcl_AppendResult(interp, "unknown option: ", pType, (char*)0);
+        return TCL_ERROR;
+      }
+
+      pResult = sf_get_string(pSnd->followfile ? pSnd->followfile->header : pSnd->sndfile,
+                              str_type);
+
+      if(pResult) {
+         return_obj = Tcl_NewStringObj(pResult, -1);
+      } else {
+         return_obj = Tcl_NewStringObj("", 0);
+      }
+
+      Tcl_SetObjResult(interp, return_obj);
+
+      break;
+    }
+
+    case SND_SET_STRING: {
+      Tcl_Obj *return_obj = NULL;
+      const char *pType = NULL;
+      const char *pString = NULL;
+      int str_type = 0;
+      Tcl_Size len = 0;
+      int result = 0;
+
+      if( objc != 4 ){
+        Tcl_WrongNumArgs(interp, 2, objv,
+          "str_type string"
+        );
+        return TCL_ERROR;
+      }
+
+      pType = Tcl_GetStringFromObj(objv[2], &len);
+      if( !pType || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      pString = Tcl_GetStringFromObj(objv[3], &len);
+      if( !pString || len < 1 ){
+        return TCL_ERROR;
+      }
+
+      if(pSnd->mode != SFM_WRITE && pSnd->mode != SFM_RDWR) {
+        return TCL_ERROR;
+      }
+
+      if( strcmp(pType, "SF_STR_TITLE")==0 ){
+        str_type = SF_STR_TITLE;
+      } else if( strcmp(pType, "SF_STR_COPYRIGHT")==0 ){
+        str_type = SF_STR_COPYRIGHT;
+      } else if( strcmp(pType, "SF_STR_SOFTWARE")==0 ){
+        str_type = SF_STR_SOFTWARE;
+      } else if( strcmp(pType, "SF_STR_ARTIST")==0 ){
+        str_type = SF_STR_ARTIST;
+      } else if( strcmp(pType, "SF_STR_COMMENT")==0 ){
+        str_type = SF_STR_COMMENT;
+      } else if( strcmp(pType, "SF_STR_DATE")==0 ){
+        str_type = SF_STR_DATE;
+      } else if( strcmp(pType, "SF_STR_ALBUM")==0 ){
+        str_type = SF_STR_ALBUM;
+      } else if( strcmp(pType, "SF_STR_LICENSE")==0 ){
+        str_type = SF_STR_LICENSE;
+      } else if( strcmp(pType, "SF_STR_TRACKNUMBER")==0 ){
+        str_type = SF_STR_TRACKNUMBER;
+      } else if( strcmp(pType, "SF_STR_GENRE")==0 ){
+        str_type = SF_STR_GENRE;
+      } else {
+        Tcl_AppendResult(interp, "unknown option: ", pType, (char*)0);
+        return TCL_ERROR;
+      }
+
+      result = sf_set_string(pSnd->sndfile, str_type, pString);
+
+      /*
+       * The sf_set_string() function sets the string data.
+       * It returns zero on success and non-zero on error.
+       */
+      return_obj = Tcl_NewIntObj(result);
+      Tcl_SetObjResult(interp, return_obj);
+
+      break;
+    }
+
+    case SND_CONFIGURE: {
+      Tcl_Obj *return_obj = NULL;
+      int option = 0;
+      int i = 0;
+
+      if( objc > 3 && (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?option? ?value option value ...?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 2 ){
+        return_obj = Tcl_NewListObj(0, NULL);
+        for(i = 0; sndConfigStrs[i]; i++) {
+          Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewStringObj(sndConfigStrs[i], -1));
+          Tcl_ListObjAppendElement(interp, return_obj, SndConfigGet(pSnd, i));
+        }
+        Tcl_SetObjResult(interp, return_obj);
+        break;
+      }
+
+      if( objc == 3 ){
+        if( Tcl_GetIndexFromObj(interp, objv[2], sndConfigStrs, "option", 0, &option) ){
+          return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, SndConfigGet(pSnd, option));
+        break;
+      }
+
+      for(i = 2; i+1 < objc; i += 2){
+        if( Tcl_GetIndexFromObj(interp, objv[i], sndConfigStrs, "option", 0, &option) ){
+          return TCL_ERROR;
+        }
+
+        if(SndConfigSet(interp, pSnd, option, objv[i+1]) != TCL_OK) {
+          return TCL_ERROR;
+        }
+      }
+      break;
+    }
+
+    case SND_UPDATE_HEADER: {
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      if(pSnd->mode != SFM_WRITE && pSnd->mode != SFM_RDWR) {
+        Tcl_AppendResult(interp, "Error: update_header needs WRITE or RDWR mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      sf_command(pSnd->sndfile, SFC_UPDATE_HEADER_NOW, NULL, 0);
+      break;
+    }
+
+    case SND_REFRESH: {
+      sf_count_t count;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      if(!pSnd->follow) {
+        Tcl_AppendResult(interp, "Error: refresh needs -follow mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      count = SndFollowRefresh(pSnd);
+      Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) count));
+      break;
+    }
+
+    case SND_ONAVAILABLE: {
+      Tcl_Size len = 0;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?script?");
+        return TCL_ERROR;
+      }
+
+      if(!pSnd->follow) {
+        Tcl_AppendResult(interp, "Error: onavailable needs -follow mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if( objc == 2 ){
+        if(pSnd->availableScript) {
+          Tcl_SetObjResult(interp, pSnd->availableScript);
+        }
+        break;
+      }
+
+      SndFollowStop(pSnd);
+
+      Tcl_GetStringFromObj(objv[2], &len);
+      if(len > 0) {
+        pSnd->availableScript = objv[2];
+        Tcl_IncrRefCount(pSnd->availableScript);
+        pSnd->followTimer = Tcl_CreateTimerHandler(pSnd->pollinterval,
+                                                   SndFollowTimerProc, pSnd);
+      }
+      break;
+    }
+
+    case SND_DRAIN: {
+      const char *zArg = NULL;
+      int result = 0;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-final?");
+        return TCL_ERROR;
+      }
+
+      if(pSnd->memfile == NULL) {
+        Tcl_AppendResult(interp, "Error: drain needs -memory mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if( objc == 3 ){
+        zArg = Tcl_GetStringFromObj(objv[2], 0);
+        if( strcmp(zArg, "-final")!=0 ){
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+
+        /*
+         * Close the encoder so that the last pages and the header update
+         * are in the buffer.
+         */
+        if(pSnd->sndfile) {
+          result = sf_close(pSnd->sndfile);
+          pSnd->sndfile = NULL;
+          if(result != 0) {
+            Tcl_AppendResult(interp, "Error: ", sf_error_number(result), (char*)0);
+            return TCL_ERROR;
+          }
+        }
+      }
+
+      Tcl_SetObjResult(interp, SndMemDrain(pSnd->memfile));
+      break;
+    }
+
+    case SND_FIND_SILENCE: {
+      Tcl_Obj *return_obj = NULL;
+      SndBuffer *buf;
+      double threshold = -60.0;
+      double minduration = 500.0;
+      sf_count_t position;
+      int channels = pSnd->sfinfo.channels;
+
+      if( objc < 2 || (objc&1)!=0 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-threshold dBFS? ?-minduration ms?");
+        return TCL_ERROR;
+      }
+
+      if(SndGetSilenceOptions(interp, objc-2, objv+2, &threshold, &minduration) != TCL_OK) {
+        return TCL_ERROR;
+      }
+
+      if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
+        Tcl_AppendResult(interp, "Error: find_silence needs READ or RDWR mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(!pSnd->sfinfo.seekable) {
+        Tcl_SetResult(interp, (char *)"Not seekable", TCL_STATIC);
+        return TCL_ERROR;
+      }
+
+      buf = SndGetBlock(pSnd, SND_TYPE_FLOAT);
+      if( buf == 0 ){
+        Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+        return TCL_ERROR;
+      }
+
+      if(buf->capacity < channels) {
+        Tcl_AppendResult(interp, "Error: buffersize needs >= channels", (char*)0);
+        return TCL_ERROR;
+      }
+
+      position = sf_seek(pSnd->sndfile, 0, SEEK_CUR);
+
+      return_obj = Tcl_NewListObj(0, NULL);
+      SndScanSilence(pSnd->sndfile, channels, (float *) buf->data, buf->capacity / channels,
+                     SndThreshold(threshold),
+                     (sf_count_t) (minduration * pSnd->sfinfo.samplerate / 1000.0),
+                     return_obj);
+
+      /* Go back to where the scan started */
+      sf_seek(pSnd->sndfile, position, SEEK_SET);
+
+      Tcl_SetObjResult(interp, return_obj);
+      break;
+    }
+
+    case SND_SPECTROGRAM: {
+      rc = SndSpectrogram(interp, pSnd, objc, objv);
+      break;
+    }
+
+    case SND_LOUDNESS: {
+      SndLoudness ld;
+      SndBuffer *buf;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
+        Tcl_AppendResult(interp, "Error: loudness needs READ or RDWR mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      buf = SndGetBlock(pSnd, SND_TYPE_DOUBLE);
+      if(buf == NULL) {
+        Tcl_SetResult(interp, (char *)SndAllocError(), TCL_STATIC);
+        return TCL_ERROR;
+      }
+
+      if(buf->capacity < pSnd->sfinfo.channels) {
+        Tcl_AppendResult(interp, "Error: buffersize needs >= channels", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(SndLoudnessInit(&ld, pSnd->sfinfo.channels, pSnd->sfinfo.samplerate) != TCL_OK ||
+         SndLoudnessRead(&ld, pSnd->sndfile, (double *) buf->data,
+                         buf->capacity / pSnd->sfinfo.channels) != TCL_OK) {
+        SndLoudnessFree(&ld);
+        Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+        return TCL_ERROR;
+      }
+
+      Tcl_SetObjResult(interp, SndLoudnessResult(&ld));
+      SndLoudnessFree(&ld);
+      break;
+    }
+
+    case SND_ONCHUNK: {
+      const char *zArg;
+      int type = SND_TYPE_FLOAT;
+      Tcl_WideInt frames;
+      Tcl_Size len = 0;
+      int i;
+
+      if( objc != 2 && (objc&1)!=1 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?-type type? ?-frames frames? ?script?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 2 ){
+        if(pSnd->async && !pSnd->async->writing) {
+          Tcl_SetObjResult(interp, pSnd->async->script);
+        }
+        break;
+      }
+
+      if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
+        Tcl_AppendResult(interp, "Error: onchunk needs READ or RDWR mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(pSnd->follow) {
+        Tcl_AppendResult(interp, "Error: onchunk does not work with -follow", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(pSnd->async && pSnd->async->writing) {
+        Tcl_AppendResult(interp, "Error: the handle is busy with onwritable", (char*)0);
+        return TCL_ERROR;
+      }
+
+      frames = (pSnd->buff_init ? pSnd->buffersize : SndDefaultBufferSize(&pSnd->sfinfo)) /
+               pSnd->sfinfo.channels;
+
+      for(i = 2; i+1 < objc; i += 2){
+        zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+        if( strcmp(zArg, "-type")==0 ){
+          if( Tcl_GetIndexFromObj(interp, objv[i+1], sndTypeNames, "type", 0, &type) ){
+            return TCL_ERROR;
+          }
+        } else if( strcmp(zArg, "-frames")==0 ){
+          if(Tcl_GetWideIntFromObj(interp, objv[i+1], &frames) != TCL_OK) {
+            return TCL_ERROR;
+          }
+
+          if(frames <= 0) {
+            Tcl_AppendResult(interp, "Error: frames needs > 0", (char*)0);
+            return TCL_ERROR;
+          }
+        } else {
+          Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+          return TCL_ERROR;
+        }
+      }
+
+      if(frames < 1) frames = 1;
+
+      SndAsyncStop(pSnd, NULL, 0);
+
+      Tcl_GetStringFromObj(objv[objc-1], &len);
+      if(len > 0) {
+        rc = SndAsyncStart(interp, pSnd, 0, type, (sf_count_t) frames, objv[objc-1]);
+      }
+      break;
+    }
+
+    case SND_ONWRITABLE: {
+      char error[256];
+      Tcl_Size len = 0;
+
+      if( objc != 2 && objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "?script?");
+        return TCL_ERROR;
+      }
+
+      if( objc == 2 ){
+        if(pSnd->async && pSnd->async->writing) {
+          Tcl_SetObjResult(interp, pSnd->async->script);
+        }
+        break;
+      }
+
+      if(pSnd->mode != SFM_WRITE && pSnd->mode != SFM_RDWR) {
+        Tcl_AppendResult(interp, "Error: onwritable needs WRITE or RDWR mode", (char*)0);
+        return TCL_ERROR;
+      }
+
+      if(pSnd->async && !pSnd->async->writing) {
+        Tcl_AppendResult(interp, "Error: the handle is busy with onchunk", (char*)0);
+        return TCL_ERROR;
+      }
+
+      /* Removing the script waits for the queued writes */
+      SndAsyncStop(pSnd, error, sizeof(error));
+      if(error[0]) {
+        Tcl_AppendResult(interp, error, (char*)0);
+        return TCL_ERROR;
+      }
+
+      Tcl_GetStringFromObj(objv[2], &len);
+      if(len > 0) {
+        rc = SndAsyncStart(interp, pSnd, 1, 0, 0, objv[2]);
+      }
+      break;
+    }
+
+    case SND_PAUSE:
+    case SND_RESUME: {
+      SndAsync *async = pSnd->async;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      if(async == NULL) {
+        Tcl_AppendResult(interp, "Error: no onchunk or onwritable script", (char*)0);
+        return TCL_ERROR;
+      }
+
+      Tcl_MutexLock(&async->mutex);
+      async->paused = (choice == SND_PAUSE);
+      if(!async->paused && (async->writing || async->count > 0 || async->eof)) {
+        SndAsyncPost(async);
+      }
+      Tcl_MutexUnlock(&async->mutex);
+      break;
+    }
+
+    case SND_MEMORY: {
       Tcl_Obj *return_obj = NULL;
-      unsigned char *zData = NULL;
-      Tcl_Size len;
-      sf_count_t count;
+      Tcl_WideInt bytes = 0;
+      int i = 0;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      for(i = 0; i < SND_TYPE_COUNT; i++) {
+        if(pSnd->blocks[i]) {
+          bytes += pSnd->blocks[i]->size;
+        }
+      }
+
+      return_obj = Tcl_NewListObj(0, NULL);
+      Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewStringObj("buffersize", -1));
+      Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewIntObj(pSnd->buff_init ?
+                               pSnd->buffersize : SndDefaultBufferSize(&pSnd->sfinfo)));
+      Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewStringObj("bytes", -1));
+      Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewWideIntObj(bytes));
+      Tcl_SetObjResult(interp, return_obj);
+      break;
+    }
+
+    case SND_CLOSE: {
+      int result = 0;
+      Tcl_Obj *return_obj = NULL;
+
+      if( objc != 2 ){
+        Tcl_WrongNumArgs(interp, 2, objv, 0);
+        return TCL_ERROR;
+      }
+
+      /* Closed here for the result, SndDeleteCmd frees the rest */
+      result = SndCloseFile(pSnd);
+      pSnd = NULL;
+
+      Tcl_DeleteCommand(interp, Tcl_GetStringFromObj(objv[0], 0));
+
+      return_obj = Tcl_NewIntObj(result);
+      Tcl_SetObjResult(interp, return_obj);
+      break;
+    }
+
+  } /* End of the SWITCH statement */
+
+  return rc;
+}
+
+
+static int SndMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndFileData *p;
+  const char *zArg;
+  int i = 0;
+  const char *zFile = NULL;
+  const char *zMode = NULL;
+  const char *zError = NULL;
+  char *fileformat = NULL;
+  char *encoding = NULL;
+  int samplerate = 44100;
+  int channels = 2;
+  Tcl_DString translatedFilename;
+  int buffersize = 0;
+  int option = 0;
+  Tcl_Obj *pResultStr = NULL;
+  Tcl_Size len;
+  int memory = 0;
+  int parallel = 0;
+
+  if( objc<4 || (objc&1)!=0 ){
+    Tcl_WrongNumArgs(interp, 1, objv,
+      "HANDLE path mode ?-buffersize size? ?-rate samplerate? ?-channels channels? ?-fileformat format? ?-encoding encoding_type? ?-compressionlevel level? ?-vbrquality quality? ?-autoheader boolean? ?-normfloat boolean? ?-normdouble boolean? ?-clipping boolean? ?-follow boolean? ?-pollinterval ms? ?-followtimeout ms? ?-memory boolean? ?-parallel threads? ?-dither dither? "
+    );
+    return TCL_ERROR;
+  }
+
+  p = (SndFileData *)Tcl_Alloc( sizeof(*p) );
+  if( p==0 ){
+    Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+    return TCL_ERROR;
+  }
+
+  memset(p, 0, sizeof(*p));
+  p->interp = interp;
+  SndConfigInit(&p->config);
+  p->pollinterval = 250;
+
+  zFile = Tcl_GetStringFromObj(objv[2], &len);
+  if( !zFile || len < 1 ){
+    Tcl_Free((char *)p);
+    return TCL_ERROR;
+  }
+
+  zMode = Tcl_GetStringFromObj(objv[3], &len);
+  if( !zMode || len < 1 ){
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: correct mode is READ, WRITE and RDWR", (char*)0);
+    return TCL_ERROR;
+  }
+
+  //SFM_READ    - read only mode
+  //SFM_WRITE   - write only mode
+  //SFM_RDWR    - read/write mode
+  if( strcmp(zMode, "READ")==0 ){
+    p->mode = SFM_READ;
+  } else if( strcmp(zMode, "WRITE")==0 ){
+    p->mode = SFM_WRITE;
+  } else if( strcmp(zMode, "RDWR")==0 ){
+    p->mode = SFM_RDWR;
+  } else {
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: correct mode is READ, WRITE and RDWR", (char*)0);
+    return TCL_ERROR;
+  }
+
+  for(i=4; i+1<objc; i+=2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-buffersize")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &buffersize) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+
+      if(buffersize <= 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: buffersize needs > 0", (char*)0);
+         return TCL_ERROR;
+      }
+
+      Tcl_MutexLock(&myMutex);
+      p->buffersize = buffersize;
+      p->buff_init = 1;
+      Tcl_MutexUnlock(&myMutex);
+    } else if( strcmp(zArg, "-rate")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &samplerate) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+
+      if(samplerate <= 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: samplerate needs > 0", (char*)0);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-channels")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &channels) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+      
+      if(channels <= 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: channels needs > 0", (char*)0);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-fileformat")==0 ){
+      fileformat = Tcl_GetStringFromObj(objv[i+1], &len);
+      if( !fileformat || len < 1 ){
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-encoding")==0 ){
+      encoding = Tcl_GetStringFromObj(objv[i+1], &len);
+      if( !encoding || len < 1 ){
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-memory")==0 ){
+      if(Tcl_GetBooleanFromObj(interp, objv[i+1], &memory) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-dither")==0 ){
+      if( Tcl_GetIndexFromObj(interp, objv[i+1], sndDitherNames, "dither", 0, &p->dither) ){
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-parallel")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &parallel) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+
+      if(parallel < 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: parallel needs >= 0", (char*)0);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-follow")==0 ){
+      if(Tcl_GetBooleanFromObj(interp, objv[i+1], &p->follow) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-pollinterval")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &p->pollinterval) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+
+      if(p->pollinterval <= 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: pollinterval needs > 0", (char*)0);
+         return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-followtimeout")==0 ){
+      if(Tcl_GetIntFromObj(interp, objv[i+1], &p->followtimeout) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+
+      if(p->followtimeout < 0) {
+         Tcl_Free((char *)p);
+         Tcl_AppendResult(interp, "Error: followtimeout needs >= 0", (char*)0);
+         return TCL_ERROR;
+      }
+    } else if( (option = SndConfigLookup(zArg)) >= 0 ){
+      if(SndConfigSet(interp, p, option, objv[i+1]) != TCL_OK) {
+         Tcl_Free((char *)p);
+         return TCL_ERROR;
+      }
+    }else{
+      Tcl_Free((char *)p);
+
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  if(p->follow && p->mode != SFM_READ) {
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: -follow needs READ mode", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(parallel && (p->mode != SFM_READ || p->follow)) {
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: -parallel needs READ mode without -follow", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(p->dither != SND_DITHER_NONE && p->mode == SFM_READ) {
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: -dither needs WRITE or RDWR mode", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(memory && p->mode != SFM_WRITE) {
+    Tcl_Free((char *)p);
+
+    Tcl_AppendResult(interp, "Error: -memory needs WRITE mode", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(p->mode != SFM_READ) {
+    if(!fileformat || !encoding) {
+      Tcl_Free((char *)p);
+
+      Tcl_AppendResult(interp, "Error: fileformat and encoding need specify a value", (char*)0);
+      return TCL_ERROR;
+    }
+
+    p->sfinfo.samplerate = samplerate;
+    p->sfinfo.channels = channels;  
+
+    if(SndParseFormat(interp, fileformat, encoding, &p->sfinfo.format) != TCL_OK) {
+       Tcl_Free((char *)p);
+       return TCL_ERROR;
+    }
+  }
+
+  if(memory) {
+    /*
+     * The path is not used, the encoded bytes go to a growable buffer
+     * and are taken out by HANDLE drain.
+     */
+    p->memfile = (SndMemFile *) malloc(sizeof(SndMemFile));
+    if( p->memfile == 0 ){
+      Tcl_Free((char *)p);
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return TCL_ERROR;
+    }
+
+    memset(p->memfile, 0, sizeof(SndMemFile));
+    p->sndfile = sf_open_virtual(&sndMemIO, p->mode, & (p->sfinfo), p->memfile);
+    if(p->sndfile == NULL) {
+      SndMemFree(p->memfile);
+      Tcl_Free((char *)p);
+      Tcl_AppendResult(interp, "Error: ", sf_strerror(NULL), (char*)0);
+      return TCL_ERROR;
+    }
+  } else {
+    zFile = Tcl_TranslateFileName(interp, zFile, &translatedFilename);
+    if(p->follow) {
+        p->pathObj = Tcl_NewStringObj(zFile, -1);
+        Tcl_IncrRefCount(p->pathObj);
+        p->filesize = SndFollowFileSize(p);
+        p->sndfile = SndFollowOpen(interp, p);
+    } else {
+        p->sndfile = sf_open(zFile, p->mode, & (p->sfinfo));
+    }
+    if(p->sndfile != NULL && parallel) {
+      if(!p->sfinfo.seekable) {
+        Tcl_AppendResult(interp, "Error: -parallel needs a seekable file", (char*)0);
+      } else {
+        p->parallel = SndParallelOpen(zFile, &p->sfinfo, parallel, &zError);
+        if(p->parallel == NULL) {
+          Tcl_AppendResult(interp, zError ? zError : "Error: cannot open the file for the -parallel workers",
+                           (char*)0);
+        }
+      }
+
+      if(p->parallel == NULL) {
+        sf_close(p->sndfile);
+        p->sndfile = NULL;
+      }
+    }
+    Tcl_DStringFree(&translatedFilename);
+
+    if(p->sndfile == NULL) {
+        if(p->pathObj) {
+          Tcl_DecrRefCount(p->pathObj);
+        }
+        Tcl_Free((char *)p);  //open fail, so we need free our memory
+        p = NULL;
+
+        return TCL_ERROR;
+    }
+  }
+
+  for(option = 0; sndConfigStrs[option]; option++) {
+    if((p->config.mask & (1 << option)) == 0) {
+      continue;
+    }
+
+    if(SndConfigApply(interp, p, option) != TCL_OK) {
+      sf_close(p->sndfile);
+      SndFollowClose(p);
+      SndParallelClose(p->parallel);
+      SndMemFree(p->memfile);
+      if(p->pathObj) {
+        Tcl_DecrRefCount(p->pathObj);
+      }
+      Tcl_Free((char *)p);
+      return TCL_ERROR;
+    }
+  }
+
+  if(p->parallel) {
+    SndParallelReset(p->parallel, 0, p->config.normfloat, p->config.normdouble);
+  }
+
+  if(p->dither != SND_DITHER_NONE) {
+    p->ditherbits = SndDitherBits(p->sfinfo.format);
+    p->ditherstate = (double *) calloc(2 * p->sfinfo.channels, sizeof(double));
+    p->ditherpending = (int *) calloc(p->sfinfo.channels, sizeof(int));
+    if(p->ditherstate == NULL || p->ditherpending == NULL) {
+      free(p->ditherstate);
+      free(p->ditherpending);
+      sf_close(p->sndfile);
+      SndMemFree(p->memfile);
+      Tcl_Free((char *)p);
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return TCL_ERROR;
+    }
+  }
+
+  fileformat = (char *) SndFileFormatName(p->sfinfo.format);
+  encoding = (char *) SndEncodingName(p->sfinfo.format);
+
+  zArg = Tcl_GetStringFromObj(objv[1], 0);
+  Tcl_CreateObjCommand(interp, zArg, SndObjCmd, (char*)p, SndDeleteCmd);
+
+  Tcl_MutexLock(&myMutex);
+  sndMemory.handles++;
+  Tcl_MutexUnlock(&myMutex);
+
+  /*
+   * sfinfo.frames is used to be called samples, not sure is OK for WRITE.
+   */
+  pResultStr = Tcl_NewListObj(0, NULL);
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("frames", -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) p->sfinfo.frames));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("fileformat", -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(fileformat, -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("encoding", -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(encoding, -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("samplerate", -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(p->sfinfo.samplerate));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("channels", -1));
+  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(p->sfinfo.channels));
+
+  Tcl_SetObjResult(interp, pResultStr);  
+  return TCL_OK;
+}
+
+
+static int SndBufferCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndBuffer *buf;
+  Tcl_Obj *pResultStr = NULL;
+  int choice;
+
+  static const char *BUF_strs[] = {
+    "info",
+    "bytes",
+    0
+  };
+
+  enum BUF_enum {
+    BUF_INFO,
+    BUF_BYTES,
+  };
+
+  if( objc < 2 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "SUBCOMMAND ...");
+    return TCL_ERROR;
+  }
+
+  if( Tcl_GetIndexFromObj(interp, objv[1], BUF_strs, "option", 0, &choice) ){
+    return TCL_ERROR;
+  }
+
+  switch( (enum BUF_enum)choice ){
+
+    case BUF_INFO: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "buffer");
+        return TCL_ERROR;
+      }
+
+      buf = SndBufferFromObj(objv[2]);
+      if(buf == NULL) {
+        Tcl_AppendResult(interp, "Error: not a sample buffer", (char*)0);
+        return TCL_ERROR;
+      }
+
+      pResultStr = Tcl_NewListObj(0, NULL);
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("type", -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(sndTypeNames[buf->type], -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("channels", -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(buf->channels));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("frames", -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) (buf->items / buf->channels)));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("samples", -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) buf->items));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("bytes", -1));
+      Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewWideIntObj((Tcl_WideInt) (buf->items * sndTypeSizes[buf->type])));
+
+      Tcl_SetObjResult(interp, pResultStr);
+      break;
+    }
+
+    case BUF_BYTES: {
+      if( objc != 3 ){
+        Tcl_WrongNumArgs(interp, 2, objv, "buffer");
+        return TCL_ERROR;
+      }
+
+      buf = SndBufferFromObj(objv[2]);
+      if(buf == NULL) {
+        Tcl_AppendResult(interp, "Error: not a sample buffer", (char*)0);
+        return TCL_ERROR;
+      }
+
+      /* One copy of the samples, without the string representation */
+      Tcl_SetObjResult(interp, Tcl_NewByteArrayObj((const unsigned char *) buf->data,
+                       (Tcl_Size) (buf->items * sndTypeSizes[buf->type])));
+      break;
+    }
+
+  } /* End of the SWITCH statement */
+
+  return TCL_OK;
+}
+
+
+/*
+ * sndfile::trim src dst ?-threshold dBFS? ?-fileformat format? ?-encoding encoding_type?
+ *
+ * Write the part of src between the first and the last loud frame to dst.
+ */
+static int SndTrimCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SNDFILE *in = NULL;
+  SNDFILE *out = NULL;
+  SF_INFO sfinfo, outinfo;
+  const char *zArg;
+  const char *fileformat = NULL;
+  const char *encoding = NULL;
+  double threshold = -60.0;
+  SndBuffer *block = NULL, *copyblock = NULL;
+  sf_count_t first = 0, last = 0;
+  Tcl_Obj *range[2];
+  int type;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc < 3 || (objc&1)!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv,
+      "src dst ?-threshold dBFS? ?-fileformat format? ?-encoding encoding_type?"
+    );
+    return TCL_ERROR;
+  }
+
+  for(i = 3; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-fileformat")==0 ){
+      fileformat = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-encoding")==0 ){
+      encoding = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if(SndGetSilenceOptions(interp, 2, objv+i, &threshold, NULL) != TCL_OK) {
+      return TCL_ERROR;
+    }
+  }
+
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  in = SndOpenFile(interp, objv[1], SFM_READ, &sfinfo);
+  if(in == NULL) {
+    return TCL_ERROR;
+  }
+
+  if(!sfinfo.seekable) {
+    sf_close(in);
+    Tcl_SetResult(interp, (char *)"Not seekable", TCL_STATIC);
+    return TCL_ERROR;
+  }
+
+  outinfo = sfinfo;
+  outinfo.frames = 0;
+  if(SndParseFormat(interp, fileformat, encoding, &outinfo.format) != TCL_OK) {
+    goto done;
+  }
+
+  type = SndLosslessType(sfinfo.format);
+  block = SndBufferAlloc(SND_TYPE_FLOAT, sfinfo.channels, SND_BLOCK_FRAMES * sfinfo.channels);
+  copyblock = SndBufferAlloc(type, sfinfo.channels, SND_BLOCK_FRAMES * sfinfo.channels);
+  if(block == NULL || copyblock == NULL) {
+    Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+    goto done;
+  }
+
+  if(SndFindSoundRange(in, sfinfo.channels, sfinfo.frames, (float *) block->data, SND_BLOCK_FRAMES,
+                       SndThreshold(threshold), &first, &last) != TCL_OK) {
+    Tcl_AppendResult(interp, "Error: ", sf_strerror(in), (char*)0);
+    goto done;
+  }
+
+  out = SndOpenFile(interp, objv[2], SFM_WRITE, &outinfo);
+  if(out == NULL) {
+    goto done;
+  }
+
+  if(last > first) {
+    if(sf_seek(in, first, SEEK_SET) != first ||
+       SndCopyFrames(in, out, type, copyblock->data, SND_BLOCK_FRAMES, last - first) < 0) {
+      Tcl_AppendResult(interp, "Error: ", sf_strerror(out), (char*)0);
+      goto done;
+    }
+  }
+
+  range[0] = Tcl_NewWideIntObj((Tcl_WideInt) first);
+  range[1] = Tcl_NewWideIntObj((Tcl_WideInt) last);
+  Tcl_SetObjResult(interp, Tcl_NewListObj(2, range));
+  rc = TCL_OK;
+
+done:
+  if(out) sf_close(out);
+  sf_close(in);
+  SndBufferRelease(block);
+  SndBufferRelease(copyblock);
+
+  return rc;
+}
+
+
+/*
+ * sndfile::split
+ *
+ * A seekable source is cut into frame ranges, and each worker opens its
+ * own SNDFILE for the source and encodes whole segments.  A source that
+ * cannot seek is decoded once by the calling thread, which queues the
+ * segments for the encoding workers.
+ */
+
+typedef struct SndSegment SndSegment;
+
+struct SndSegment {
+  char *name;              /* Translated output file name */
+  SndBuffer *data;         /* Pipeline mode: decoded frames */
+  sf_count_t frames;
+  SndSegment *next;
+};
+
+typedef struct SndSplit SndSplit;
+
+struct SndSplit {
+  Tcl_Mutex mutex;
+  Tcl_Condition cond;
+  const char *src;         /* Translated source file name */
+  SF_INFO outinfo;
+  int channels;
+  int type;
+  sf_count_t frames;       /* Frames of the source */
+  sf_count_t segframes;
+  int pipeline;
+
+  /* Seekable sources */
+  SndSegment *segments;
+  sf_count_t count;
+  sf_count_t next;
+
+  /* Pipeline mode */
+  SndSegment *head;
+  SndSegment *tail;
+  int queued;
+  int maxqueue;
+  int eof;
+
+  char error[256];
+};
+
+/*
+ * Keep the first error.  Without "zFile" the message is kept as it is.
+ */
+static void SndSplitError(SndSplit *split, const char *zFile, const char *zMsg){
+  Tcl_MutexLock(&split->mutex);
+  if(split->error[0] == 0 && zFile == NULL) {
+    snprintf(split->error, sizeof(split->error), "%s", zMsg);
+  } else if(split->error[0] == 0) {
+    snprintf(split->error, sizeof(split->error), "Error: %s: %s", zFile, zMsg);
+  }
+  Tcl_ConditionNotify(&split->cond);
+  Tcl_MutexUnlock(&split->mutex);
+}
+
+static int SndSplitEncode(SndSplit *split, SndSegment *seg, SNDFILE *in, void *block){
+  SF_INFO outinfo = split->outinfo;
+  SNDFILE *out;
+  sf_count_t start, count;
+
+  out = sf_open(seg->name, SFM_WRITE, &outinfo);
+  if(out == NULL) {
+    SndSplitError(split, seg->name, sf_strerror(NULL));
+    return TCL_ERROR;
+  }
+
+  if(in) {
+    start = (seg - split->segments) * split->segframes;
+    if(sf_seek(in, start, SEEK_SET) != start) {
+      SndSplitError(split, split->src, sf_strerror(in));
+      sf_close(out);
+      return TCL_ERROR;
+    }
+    count = SndCopyFrames(in, out, split->type, block, SND_BLOCK_FRAMES, seg->frames);
+  } else {
+    count = SndWriteFrames(out, split->type, seg->data->data, seg->frames);
+  }
+
+  if(count != seg->frames) {
+    SndSplitError(split, seg->name, sf_strerror(out));
+    sf_close(out);
+    return TCL_ERROR;
+  }
+
+  sf_close(out);
+  return TCL_OK;
+}
+
+static void SndSplitWorker(void *clientData){
+  SndSplit *split = (SndSplit *) clientData;
+  SndSegment *seg;
+  SNDFILE *in = NULL;
+  SF_INFO sfinfo;
+  SndBuffer *block = NULL;
+
+  if(!split->pipeline) {
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    in = sf_open(split->src, SFM_READ, &sfinfo);
+    if(in == NULL) {
+      SndSplitError(split, split->src, sf_strerror(NULL));
+      return;
+    }
+
+    block = SndBufferAlloc(split->type, split->channels, SND_BLOCK_FRAMES * split->channels);
+    if(block == NULL) {
+      SndSplitError(split, NULL, SndAllocError());
+      sf_close(in);
+      return;
+    }
+  }
+
+  for(;;) {
+    Tcl_MutexLock(&split->mutex);
+    if(split->pipeline) {
+      while(split->head == NULL && !split->eof && split->error[0] == 0) {
+        Tcl_ConditionWait(&split->cond, &split->mutex, NULL);
+      }
+
+      seg = split->error[0] ? NULL : split->head;
+      if(seg) {
+        split->head = seg->next;
+        if(split->head == NULL) split->tail = NULL;
+        split->queued--;
+        Tcl_ConditionNotify(&split->cond);
+      }
+    } else {
+      seg = NULL;
+      if(split->error[0] == 0 && split->next < split->count) {
+        seg = &split->segments[split->next++];
+      }
+    }
+    Tcl_MutexUnlock(&split->mutex);
+
+    if(seg == NULL) {
+      break;
+    }
+
+    SndSplitEncode(split, seg, in, block ? block->data : NULL);
+
+    if(split->pipeline) {
+      SndBufferRelease(seg->data);
+      free(seg->name);
+      free(seg);
+    }
+  }
+
+  if(in) sf_close(in);
+  SndBufferRelease(block);
+}
+
+/*
+ * Only one integer conversion (like %d or %05d) and %% are allowed in
+ * the pattern, so that it can be passed to snprintf.
+ */
+static int SndCheckPattern(const char *pattern){
+  const char *z;
+  int count = 0;
+
+  for(z = pattern; *z; z++) {
+    if(*z != '%') continue;
+
+    z++;
+    if(*z == '%') continue;
+
+    if(*z == '0') z++;
+    while(*z >= '0' && *z <= '9') z++;
+    if(*z != 'd') return 0;
+    count++;
+  }
+
+  return count == 1;
+}
+
+static char *SndSegmentName(Tcl_Interp *interp, const char *pattern, sf_count_t index,
+                            Tcl_Obj *listPtr){
+  Tcl_DString translatedFilename;
+  const char *zFile;
+  char *name;
+  size_t size = strlen(pattern) + 32;
+
+  name = (char *) malloc(size);
+  if(name == NULL) {
+    return NULL;
+  }
+  snprintf(name, size, pattern, (int) index);
+  Tcl_ListObjAppendElement(interp, listPtr, Tcl_NewStringObj(name, -1));
+
+  zFile = Tcl_TranslateFileName(interp, name, &translatedFilename);
+  free(name);
+  if(zFile == NULL) {
+    return NULL;
+  }
+
+  name = strdup(zFile);
+  Tcl_DStringFree(&translatedFilename);
+
+  return name;
+}
+
+static int SndSplitCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndSplit split;
+  SndWorkers workers;
+  SndSegment *seg;
+  SNDFILE *in = NULL;
+  SF_INFO sfinfo;
+  Tcl_DString translatedFilename;
+  Tcl_Obj *listPtr = NULL;
+  const char *zArg;
+  const char *pattern = NULL;
+  const char *fileformat = NULL;
+  const char *encoding = NULL;
+  double seconds = 0;
+  int threads = 1;
+  sf_count_t i, got, n;
+  size_t framesize;
+  int rc = TCL_ERROR;
+
+  if( objc < 2 || (objc&1)!=0 ){
+    Tcl_WrongNumArgs(interp, 1, objv,
+      "src -seconds seconds -pattern pattern ?-threads threads? ?-fileformat format? ?-encoding encoding_type?"
+    );
+    return TCL_ERROR;
+  }
+
+  for(i = 2; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-seconds")==0 ){
+      if(Tcl_GetDoubleFromObj(interp, objv[i+1], &seconds) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-pattern")==0 ){
+      pattern = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-threads")==0 ){
+      if(SndGetThreadsOption(interp, objv[i+1], &threads) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-fileformat")==0 ){
+      fileformat = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-encoding")==0 ){
+      encoding = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  if(seconds <= 0) {
+    Tcl_AppendResult(interp, "Error: seconds needs > 0", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(pattern == NULL || !SndCheckPattern(pattern)) {
+    Tcl_AppendResult(interp, "Error: pattern needs one integer conversion like %05d", (char*)0);
+    return TCL_ERROR;
+  }
+
+  memset(&split, 0, sizeof(split));
+  memset(&sfinfo, 0, sizeof(sfinfo));
+
+  split.src = Tcl_TranslateFileName(interp, Tcl_GetString(objv[1]), &translatedFilename);
+  if(split.src == NULL) {
+    return TCL_ERROR;
+  }
+
+  in = sf_open(split.src, SFM_READ, &sfinfo);
+  if(in == NULL) {
+    Tcl_AppendResult(interp, "Error: ", Tcl_GetString(objv[1]), ": ", sf_strerror(NULL), (char*)0);
+    Tcl_DStringFree(&translatedFilename);
+    return TCL_ERROR;
+  }
+
+  split.outinfo = sfinfo;
+  split.outinfo.frames = 0;
+  if(SndParseFormat(interp, fileformat, encoding, &split.outinfo.format) != TCL_OK) {
+    goto done;
+  }
+
+  split.channels = sfinfo.channels;
+  split.type = SndLosslessType(sfinfo.format);
+  split.frames = sfinfo.frames;
+  split.segframes = (sf_count_t) (seconds * sfinfo.samplerate);
+  split.pipeline = !sfinfo.seekable;
+  framesize = sfinfo.channels * sndTypeSizes[split.type];
+  if(split.segframes < 1) split.segframes = 1;
+
+  listPtr = Tcl_NewListObj(0, NULL);
+  Tcl_IncrRefCount(listPtr);
+
+  if(!split.pipeline) {
+    sf_close(in);
+    in = NULL;
+
+    split.count = (split.frames + split.segframes - 1) / split.segframes;
+    if(split.count > 0) {
+      split.segments = (SndSegment *) calloc(split.count, sizeof(SndSegment));
+      if(split.segments == NULL) {
+        Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+        goto done;
+      }
+    }
+
+    for(i = 0; i < split.count; i++) {
+      split.segments[i].name = SndSegmentName(interp, pattern, i, listPtr);
+      if(split.segments[i].name == NULL) {
+        goto done;
+      }
+      split.segments[i].frames = split.frames - i * split.segframes;
+      if(split.segments[i].frames > split.segframes) {
+        split.segments[i].frames = split.segframes;
+      }
+    }
+
+    SndRunWorkers(threads, SndSplitWorker, &split);
+  } else {
+    split.maxqueue = threads;
+    SndStartWorkers(&workers, threads, SndSplitWorker, &split);
+
+    for(i = 0; split.error[0] == 0; i++) {
+      seg = (SndSegment *) calloc(1, sizeof(SndSegment));
+      if(seg) seg->data = SndBufferAlloc(split.type, split.channels,
+                                         split.segframes * split.channels);
+      if(seg == NULL || seg->data == NULL) {
+        if(seg) free(seg);
+        SndSplitError(&split, NULL, SndAllocError());
+        break;
+      }
+
+      for(got = 0; got < split.segframes; got += n) {
+        n = SndReadFrames(in, split.type, (char *) seg->data->data + got * framesize,
+                          split.segframes - got);
+        if(n <= 0) break;
+      }
+
+      if(got == 0) {
+        SndBufferRelease(seg->data);
+        free(seg);
+        break;
+      }
+
+      seg->frames = got;
+      seg->name = SndSegmentName(interp, pattern, i, listPtr);
+      if(seg->name == NULL) {
+        SndBufferRelease(seg->data);
+        free(seg);
+        SndSplitError(&split, split.src, Tcl_GetStringResult(interp));
+        break;
+      }
+
+      Tcl_MutexLock(&split.mutex);
+      while(split.queued >= split.maxqueue && split.error[0] == 0 && workers.started > 0) {
+        Tcl_ConditionWait(&split.cond, &split.mutex, NULL);
+      }
+
+      if(workers.started == 0) {
+        /* No threads: encode here */
+        Tcl_MutexUnlock(&split.mutex);
+        SndSplitEncode(&split, seg, NULL, NULL);
+        SndBufferRelease(seg->data);
+        free(seg->name);
+        free(seg);
+        continue;
+      }
+
+      if(split.tail) split.tail->next = seg; else split.head = seg;
+      split.tail = seg;
+      split.queued++;
+      Tcl_ConditionNotify(&split.cond);
+      Tcl_MutexUnlock(&split.mutex);
+    }
+
+    Tcl_MutexLock(&split.mutex);
+    split.eof = 1;
+    Tcl_ConditionNotify(&split.cond);
+    Tcl_MutexUnlock(&split.mutex);
+
+    SndJoinWorkers(&workers);
+
+    /* Segments left behind after an error */
+    while(split.head) {
+      seg = split.head;
+      split.head = seg->next;
+      SndBufferRelease(seg->data);
+      free(seg->name);
+      free(seg);
+    }
+  }
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "byte_array"
-        );
+  if(split.error[0]) {
+    Tcl_ResetResult(interp);
+    Tcl_AppendResult(interp, split.error, (char*)0);
+    goto done;
+  }
+
+  Tcl_SetObjResult(interp, listPtr);
+  rc = TCL_OK;
+
+done:
+  if(in) sf_close(in);
+  if(split.segments) {
+    for(i = 0; i < split.count; i++) {
+      free(split.segments[i].name);
+    }
+    free(split.segments);
+  }
+  if(listPtr) Tcl_DecrRefCount(listPtr);
+  Tcl_DStringFree(&translatedFilename);
+  Tcl_MutexFinalize(&split.mutex);
+  Tcl_ConditionFinalize(&split.cond);
+
+  return rc;
+}
+
+
+/*
+ * sndfile::concat dst src ?src ...?
+ *
+ * Join files with the same sample rate and channel count.  dst uses the
+ * format of the first source.  Sources in exactly that format with an
+ * encoding that stores samples one by one (PCM, float, ulaw, alaw) are
+ * copied as raw data, libsndfile still writes the header; the others are
+ * decoded and encoded again.
+ */
+static int SndConcatCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SNDFILE *in = NULL;
+  SNDFILE *out = NULL;
+  SF_INFO first, sfinfo, outinfo;
+  SndBuffer *block = NULL;
+  sf_count_t total = 0;
+  sf_count_t count;
+  size_t blockbytes;
+  int samplesize;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc < 3 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "dst src ?src ...?");
+    return TCL_ERROR;
+  }
+
+  /* Check all sources before creating dst */
+  for(i = 2; i < objc; i++) {
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    in = SndOpenFile(interp, objv[i], SFM_READ, &sfinfo);
+    if(in == NULL) {
+      return TCL_ERROR;
+    }
+    sf_close(in);
+    in = NULL;
+
+    if(i == 2) {
+      first = sfinfo;
+    } else if(sfinfo.samplerate != first.samplerate || sfinfo.channels != first.channels) {
+      Tcl_AppendResult(interp, "Error: ", Tcl_GetString(objv[i]),
+                       ": samplerate and channels need to match", (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  /* Big enough for a block of doubles, the largest sample type */
+  blockbytes = SND_BLOCK_FRAMES * first.channels * sizeof(double);
+  block = SndBufferAlloc(SND_TYPE_DOUBLE, first.channels, SND_BLOCK_FRAMES * first.channels);
+  if(block == NULL) {
+    Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+    return TCL_ERROR;
+  }
+
+  outinfo = first;
+  outinfo.frames = 0;
+  out = SndOpenFile(interp, objv[1], SFM_WRITE, &outinfo);
+  if(out == NULL) {
+    goto done;
+  }
+
+  for(i = 2; i < objc; i++) {
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    in = SndOpenFile(interp, objv[i], SFM_READ, &sfinfo);
+    if(in == NULL) {
+      goto done;
+    }
+
+    samplesize = SndRawSampleSize(sfinfo.format);
+    if(sfinfo.format == first.format && samplesize > 0) {
+      count = SndCopyRaw(in, out, block->data, blockbytes, samplesize * sfinfo.channels);
+    } else {
+      count = SndCopyFrames(in, out, SndLosslessType(sfinfo.format), block->data,
+                            SND_BLOCK_FRAMES, -1);
+    }
+
+    if(count < 0) {
+      Tcl_AppendResult(interp, "Error: ", Tcl_GetString(objv[1]), ": ", sf_strerror(out), (char*)0);
+      goto done;
+    }
+
+    total += count;
+    sf_close(in);
+    in = NULL;
+  }
+
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) total));
+  rc = TCL_OK;
+
+done:
+  if(in) sf_close(in);
+  if(out) sf_close(out);
+  SndBufferRelease(block);
+
+  return rc;
+}
+
+
+/*
+ * sndfile::convert src dst ?-threads threads? ?-fileformat format? ?-encoding encoding_type?
+ *
+ * Decode src and encode it again as dst, in the format of src unless
+ * -fileformat or -encoding is given.  With more than one thread and a
+ * seekable src, the threads decode chunks of src ahead while the calling
+ * thread encodes them in order.
+ */
+static int SndConvertCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SNDFILE *in = NULL;
+  SNDFILE *out = NULL;
+  SndParallel *par = NULL;
+  SF_INFO sfinfo, outinfo;
+  Tcl_DString translatedFilename;
+  const char *zArg;
+  const char *zFile;
+  const char *fileformat = NULL;
+  const char *encoding = NULL;
+  SndBuffer *block = NULL;
+  sf_count_t total = 0;
+  sf_count_t count;
+  int threads = 1;
+  int type;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc < 3 || (objc&1)!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv,
+      "src dst ?-threads threads? ?-fileformat format? ?-encoding encoding_type?"
+    );
+    return TCL_ERROR;
+  }
+
+  for(i = 3; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-fileformat")==0 ){
+      fileformat = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-encoding")==0 ){
+      encoding = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-threads")==0 ){
+      if(SndGetThreadsOption(interp, objv[i+1], &threads) != TCL_OK) {
         return TCL_ERROR;
       }
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
 
-      zData = Tcl_GetByteArrayFromObj(objv[2], &len);
-      if( !zData || len < 1 ){
-          return TCL_ERROR;
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  in = SndOpenFile(interp, objv[1], SFM_READ, &sfinfo);
+  if(in == NULL) {
+    return TCL_ERROR;
+  }
+
+  outinfo = sfinfo;
+  outinfo.frames = 0;
+  if(SndParseFormat(interp, fileformat, encoding, &outinfo.format) != TCL_OK) {
+    goto done;
+  }
+
+  type = SndLosslessType(sfinfo.format);
+  block = SndBufferAlloc(type, sfinfo.channels, (sf_count_t) SND_PARALLEL_FRAMES * sfinfo.channels);
+  if(block == NULL) {
+    Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+    goto done;
+  }
+
+  if(threads > 1 && sfinfo.seekable) {
+    zFile = Tcl_TranslateFileName(interp, Tcl_GetString(objv[1]), &translatedFilename);
+    if(zFile == NULL) {
+      goto done;
+    }
+    /* Decoded serially when the workers cannot start */
+    par = SndParallelOpen(zFile, &sfinfo, threads, NULL);
+    Tcl_DStringFree(&translatedFilename);
+  }
+
+  out = SndOpenFile(interp, objv[2], SFM_WRITE, &outinfo);
+  if(out == NULL) {
+    goto done;
+  }
+
+  if(par) {
+    while((count = SndParallelRead(par, type, block->data, SND_PARALLEL_FRAMES)) > 0) {
+      if(SndWriteFrames(out, type, block->data, count) != count) {
+        total = -1;
+        break;
       }
+      total += count;
+    }
+  } else {
+    total = SndCopyFrames(in, out, type, block->data, SND_PARALLEL_FRAMES, -1);
+  }
 
-      count = sf_write_float(pSnd->sndfile, (float *) zData, len/sizeof(float));
-      return_obj = Tcl_NewIntObj((sf_count_t) count);
-      Tcl_SetObjResult(interp, return_obj);
+  if(total < 0) {
+    Tcl_AppendResult(interp, "Error: ", Tcl_GetString(objv[2]), ": ", sf_strerror(out), (char*)0);
+    goto done;
+  }
 
-      break;
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) total));
+  rc = TCL_OK;
+
+done:
+  SndParallelClose(par);
+  if(in) sf_close(in);
+  if(out) sf_close(out);
+  SndBufferRelease(block);
+
+  return rc;
+}
+
+
+/*
+ * sndfile::render dst editList ?-fileformat format? ?-encoding encoding_type?
+ *
+ * Mix clips of source files into dst in one pass.  Each clip is a list of
+ * options:
+ *
+ *   -source path -in frame -out frame ?-at frame? ?-gain dB?
+ *   ?-fadein frames? ?-fadeout frames? ?-envelope {frame dB ...}?
+ *
+ * -at is the position on the output timeline, by default the end of the
+ * previous clip.  Clips that overlap are added together, so a fadeout
+ * over a fadein of the same length is a crossfade.  Each clip reads
+ * through a reader of its source that no other playing clip uses, so
+ * overlapping clips of one source do not seek on every block.  A source
+ * gets as many readers as it has clips playing at the same time, and a
+ * reader is only seeked when a clip does not continue where its last
+ * read stopped.
+ */
+
+typedef struct SndRenderReader SndRenderReader;
+
+struct SndRenderReader {
+  SNDFILE *sndfile;
+  sf_count_t position;
+  int busy;                /* A playing clip reads through it */
+  SndRenderReader *next;
+};
+
+typedef struct SndRenderSource SndRenderSource;
+
+struct SndRenderSource {
+  Tcl_Obj *pathObj;
+  SF_INFO sfinfo;
+  SndRenderReader *readers;
+};
+
+typedef struct SndEnvPoint SndEnvPoint;
+
+struct SndEnvPoint {
+  sf_count_t frame;        /* From the start of the clip */
+  double gain;
+};
+
+typedef struct SndClip SndClip;
+
+struct SndClip {
+  SndRenderSource *source;
+  SndRenderReader *reader; /* While the clip plays */
+  sf_count_t in;
+  sf_count_t length;
+  sf_count_t at;
+  double gain;
+  sf_count_t fadein;
+  sf_count_t fadeout;
+  SndEnvPoint *envelope;
+  int npoints;
+  int envpos;
+};
+
+static int SndCompareClip(const void *a, const void *b){
+  const SndClip *x = (const SndClip *) a, *y = (const SndClip *) b;
+
+  return x->at < y->at ? -1 : x->at > y->at ? 1 : 0;
+}
+
+static int SndCompareEnvPoint(const void *a, const void *b){
+  const SndEnvPoint *x = (const SndEnvPoint *) a, *y = (const SndEnvPoint *) b;
+
+  return x->frame < y->frame ? -1 : x->frame > y->frame ? 1 : 0;
+}
+
+/*
+ * Gain of frames [p, p + n) of a clip: -gain, fades and the envelope,
+ * with the envelope linear between its points.  Each part is applied
+ * over the range of frames it covers, with loops that the compiler can
+ * vectorize.
+ */
+static void SndClipGain(SndClip *clip, sf_count_t p, sf_count_t n, double *gain){
+  SndEnvPoint *env = clip->envelope, *a;
+  sf_count_t k, from, to, origin;
+  double g, slope;
+
+  for(k = 0; k < n; k++) {
+    gain[k] = clip->gain;
+  }
+
+  to = clip->fadein - p < n ? clip->fadein - p : n;
+  for(k = 0; k < to; k++) {
+    gain[k] *= (double) (p + k) / clip->fadein;
+  }
+
+  if(clip->fadeout > 0) {
+    from = clip->length - clip->fadeout - p;
+    for(k = from > 0 ? from : 0; k < n; k++) {
+      gain[k] *= (double) (clip->length - p - k) / clip->fadeout;
     }
+  }
 
-    case SND_WRITE_DOUBLE: {
-      Tcl_Obj *return_obj = NULL;
-      unsigned char *zData = NULL;
-      Tcl_Size len;
-      sf_count_t count;
+  /* One piece of the envelope at a time: flat before the first and after
+   * the last point, linear in between */
+  for(k = 0; clip->npoints > 0 && k < n; k = to) {
+    while(clip->envpos + 1 < clip->npoints && env[clip->envpos + 1].frame <= p + k) {
+      clip->envpos++;
+    }
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "byte_array"
-        );
+    a = &env[clip->envpos];
+    origin = 0;
+    slope = 0.0;
+    if(p + k <= env[0].frame) {
+      g = env[0].gain;
+      to = env[0].frame - p + 1;
+    } else if(clip->envpos + 1 >= clip->npoints) {
+      g = env[clip->npoints - 1].gain;
+      to = n;
+    } else {
+      g = a->gain;
+      origin = a->frame;
+      slope = (a[1].gain - a->gain) / (double) (a[1].frame - a->frame);
+      to = a[1].frame - p;
+    }
+    if(to > n) to = n;
+
+    for(; k < to; k++) {
+      gain[k] *= g + slope * (double) (p + k - origin);
+    }
+    k = to;
+  }
+}
+
+static void SndMixGain(double *mix, const double *in, const double *gain,
+                       sf_count_t frames, int channels){
+  sf_count_t k;
+  int c;
+
+  for(k = 0; k < frames; k++) {
+    for(c = 0; c < channels; c++) {
+      mix[k * channels + c] += in[k * channels + c] * gain[k];
+    }
+  }
+}
+
+static void SndClipFree(SndClip *clips, int nclips){
+  int i;
+
+  for(i = 0; i < nclips; i++) {
+    free(clips[i].envelope);
+  }
+  free(clips);
+}
+
+/*
+ * Parse one clip.  Sources are opened through the cache "sources".
+ */
+static int SndParseClip(Tcl_Interp *interp, Tcl_Obj *clipObj, int index, sf_count_t at,
+                        Tcl_HashTable *sources, SndClip *clip){
+  Tcl_Obj **elems, **points;
+  Tcl_Size nelems, npoints;
+  Tcl_Obj *sourceObj = NULL;
+  Tcl_HashEntry *entry;
+  SndRenderSource *src;
+  Tcl_WideInt in = -1, out = -1, value;
+  char prefix[64];
+  const char *zArg;
+  double db;
+  int isNew, i;
+
+  snprintf(prefix, sizeof(prefix), "Error: clip %d: ", index);
+
+  if(Tcl_ListObjGetElements(interp, clipObj, &nelems, &elems) != TCL_OK) {
+    return TCL_ERROR;
+  }
+
+  if(nelems & 1) {
+    Tcl_AppendResult(interp, prefix, "needs option value pairs", (char*)0);
+    return TCL_ERROR;
+  }
+
+  memset(clip, 0, sizeof(*clip));
+  clip->at = at;
+  clip->gain = 1.0;
+
+  for(i = 0; i + 1 < nelems; i += 2) {
+    zArg = Tcl_GetString(elems[i]);
+
+    if( strcmp(zArg, "-source")==0 ){
+      sourceObj = elems[i+1];
+      continue;
+    }
+
+    if( strcmp(zArg, "-gain")==0 ){
+      if(Tcl_GetDoubleFromObj(interp, elems[i+1], &db) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      clip->gain = pow(10.0, db / 20.0);
+      continue;
+    }
+
+    if( strcmp(zArg, "-envelope")==0 ){
+      if(Tcl_ListObjGetElements(interp, elems[i+1], &npoints, &points) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if(npoints & 1) {
+        Tcl_AppendResult(interp, prefix, "-envelope needs frame dB pairs", (char*)0);
         return TCL_ERROR;
       }
 
-      zData = Tcl_GetByteArrayFromObj(objv[2], &len);
-      if( !zData || len < 1 ){
+      free(clip->envelope);
+      clip->npoints = 0;
+      clip->envelope = (SndEnvPoint *) malloc((npoints / 2 + 1) * sizeof(SndEnvPoint));
+      if(clip->envelope == NULL) {
+        Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+        return TCL_ERROR;
+      }
+      for(; clip->npoints < npoints / 2; clip->npoints++) {
+        if(Tcl_GetWideIntFromObj(interp, points[2 * clip->npoints], &value) != TCL_OK ||
+           Tcl_GetDoubleFromObj(interp, points[2 * clip->npoints + 1], &db) != TCL_OK) {
           return TCL_ERROR;
+        }
+        clip->envelope[clip->npoints].frame = (sf_count_t) value;
+        clip->envelope[clip->npoints].gain = pow(10.0, db / 20.0);
       }
+      qsort(clip->envelope, clip->npoints, sizeof(SndEnvPoint), SndCompareEnvPoint);
+      continue;
+    }
+
+    if(Tcl_GetWideIntFromObj(interp, elems[i+1], &value) != TCL_OK) {
+      return TCL_ERROR;
+    }
+    if(value < 0) {
+      Tcl_AppendResult(interp, prefix, zArg, " needs >= 0", (char*)0);
+      return TCL_ERROR;
+    }
+
+    if( strcmp(zArg, "-in")==0 ){
+      in = value;
+    } else if( strcmp(zArg, "-out")==0 ){
+      out = value;
+    } else if( strcmp(zArg, "-at")==0 ){
+      clip->at = (sf_count_t) value;
+    } else if( strcmp(zArg, "-fadein")==0 ){
+      clip->fadein = (sf_count_t) value;
+    } else if( strcmp(zArg, "-fadeout")==0 ){
+      clip->fadeout = (sf_count_t) value;
+    } else {
+      Tcl_AppendResult(interp, prefix, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  if(sourceObj == NULL || in < 0 || out < 0) {
+    Tcl_AppendResult(interp, prefix, "needs -source, -in and -out", (char*)0);
+    return TCL_ERROR;
+  }
+
+  entry = Tcl_CreateHashEntry(sources, Tcl_GetString(sourceObj), &isNew);
+  if(isNew) {
+    src = (SndRenderSource *) calloc(1, sizeof(SndRenderSource));
+    if(src != NULL) {
+      src->readers = (SndRenderReader *) calloc(1, sizeof(SndRenderReader));
+    }
+    if(src == NULL || src->readers == NULL) {
+      free(src);
+      Tcl_DeleteHashEntry(entry);
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return TCL_ERROR;
+    }
+
+    src->readers->sndfile = SndOpenFile(interp, sourceObj, SFM_READ, &src->sfinfo);
+    if(src->readers->sndfile == NULL) {
+      free(src->readers);
+      free(src);
+      Tcl_DeleteHashEntry(entry);
+      return TCL_ERROR;
+    }
+    src->pathObj = sourceObj;
+    Tcl_IncrRefCount(src->pathObj);
+    Tcl_SetHashValue(entry, src);
+  }
+  clip->source = (SndRenderSource *) Tcl_GetHashValue(entry);
+
+  if(out <= in || out > clip->source->sfinfo.frames) {
+    Tcl_AppendResult(interp, prefix, "needs -in < -out <= frames of the source", (char*)0);
+    return TCL_ERROR;
+  }
+
+  if(in > 0 && !clip->source->sfinfo.seekable) {
+    Tcl_AppendResult(interp, prefix, "Not seekable", (char*)0);
+    return TCL_ERROR;
+  }
+
+  clip->in = (sf_count_t) in;
+  clip->length = (sf_count_t) (out - in);
+  if(clip->fadein > clip->length) clip->fadein = clip->length;
+  if(clip->fadeout > clip->length) clip->fadeout = clip->length;
+
+  return TCL_OK;
+}
+
+/*
+ * A reader of the clip's source that no playing clip uses, preferably one
+ * that stopped at "want".  Opens another one when all are busy.
+ */
+static SndRenderReader *SndRenderAcquire(Tcl_Interp *interp, SndRenderSource *src, sf_count_t want){
+  SndRenderReader *reader, *idle = NULL;
+  SF_INFO sfinfo;
+
+  for(reader = src->readers; reader; reader = reader->next) {
+    if(reader->busy) {
+      continue;
+    }
+    if(reader->position == want) {
+      idle = reader;
+      break;
+    }
+    if(idle == NULL) {
+      idle = reader;
+    }
+  }
+
+  if(idle == NULL) {
+    idle = (SndRenderReader *) calloc(1, sizeof(SndRenderReader));
+    if(idle == NULL) {
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return NULL;
+    }
+
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    idle->sndfile = SndOpenFile(interp, src->pathObj, SFM_READ, &sfinfo);
+    if(idle->sndfile == NULL) {
+      free(idle);
+      return NULL;
+    }
+    idle->next = src->readers;
+    src->readers = idle;
+  }
+
+  idle->busy = 1;
+  return idle;
+}
+
+static int SndRenderCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  Tcl_HashTable sources;
+  Tcl_HashSearch search;
+  Tcl_HashEntry *entry;
+  SndRenderSource *src;
+  SndRenderReader *reader;
+  SndClip *clips = NULL, *clip;
+  SNDFILE *out = NULL;
+  SF_INFO outinfo;
+  Tcl_Obj **clipObjs;
+  Tcl_Size nclips = 0;
+  const char *zArg;
+  const char *fileformat = NULL;
+  const char *encoding = NULL;
+  SndBuffer *mixbuf = NULL, *inbuf = NULL, *gainbuf = NULL;
+  double *mix, *in, *gain;
+  sf_count_t at = 0, end = 0, t, n, start, stop, want, got;
+  int channels = 0;
+  int first = 0;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc < 3 || (objc&1)!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "dst editList ?-fileformat format? ?-encoding encoding_type?");
+    return TCL_ERROR;
+  }
+
+  for(i = 3; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-fileformat")==0 ){
+      fileformat = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else if( strcmp(zArg, "-encoding")==0 ){
+      encoding = Tcl_GetStringFromObj(objv[i+1], 0);
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
+
+  if(Tcl_ListObjGetElements(interp, objv[2], &nclips, &clipObjs) != TCL_OK) {
+    return TCL_ERROR;
+  }
+
+  if(nclips == 0) {
+    Tcl_AppendResult(interp, "Error: editList needs at least one clip", (char*)0);
+    return TCL_ERROR;
+  }
+
+  Tcl_InitHashTable(&sources, TCL_STRING_KEYS);
+
+  clips = (SndClip *) calloc(nclips, sizeof(SndClip));
+  if(clips == NULL) {
+    Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+    goto done;
+  }
+
+  for(i = 0; i < nclips; i++) {
+    if(SndParseClip(interp, clipObjs[i], i, at, &sources, &clips[i]) != TCL_OK) {
+      goto done;
+    }
+
+    src = clips[i].source;
+    if(i == 0) {
+      outinfo = src->sfinfo;
+      channels = outinfo.channels;
+    } else if(src->sfinfo.samplerate != outinfo.samplerate || src->sfinfo.channels != channels) {
+      char prefix[64];
+      snprintf(prefix, sizeof(prefix), "Error: clip %d: ", i);
+      Tcl_AppendResult(interp, prefix, "samplerate and channels need to match", (char*)0);
+      goto done;
+    }
+
+    at = clips[i].at + clips[i].length;
+    if(at > end) end = at;
+  }
+
+  qsort(clips, nclips, sizeof(SndClip), SndCompareClip);
+
+  mixbuf = SndBufferAlloc(SND_TYPE_DOUBLE, channels, SND_BLOCK_FRAMES * channels);
+  inbuf = SndBufferAlloc(SND_TYPE_DOUBLE, channels, SND_BLOCK_FRAMES * channels);
+  gainbuf = SndBufferAlloc(SND_TYPE_DOUBLE, 1, SND_BLOCK_FRAMES);
+  if(mixbuf == NULL || inbuf == NULL || gainbuf == NULL) {
+    Tcl_AppendResult(interp, SndAllocError(), (char*)0);
+    goto done;
+  }
+  mix = (double *) mixbuf->data;
+  in = (double *) inbuf->data;
+  gain = (double *) gainbuf->data;
+
+  outinfo.frames = 0;
+  if(SndParseFormat(interp, fileformat, encoding, &outinfo.format) != TCL_OK) {
+    goto done;
+  }
+
+  out = SndOpenFile(interp, objv[1], SFM_WRITE, &outinfo);
+  if(out == NULL) {
+    goto done;
+  }
+  /* Overlapping clips and -gain can sum above full scale: saturate
+   * instead of letting integer encodings wrap */
+  sf_command(out, SFC_SET_CLIPPING, NULL, SF_TRUE);
 
-      count = sf_write_double(pSnd->sndfile, (double *) zData, len/sizeof(double));
-      return_obj = Tcl_NewIntObj((sf_count_t) count);
-      Tcl_SetObjResult(interp, return_obj);
+  for(t = 0; t < end; t += n) {
+    n = end - t < SND_BLOCK_FRAMES ? end - t : SND_BLOCK_FRAMES;
+    memset(mix, 0, n * channels * sizeof(double));
 
-      break;
+    /* Clips that ended before this block are skipped for good */
+    while(first < nclips && clips[first].at + clips[first].length <= t) {
+      first++;
     }
 
-    case SND_SEEK: {
-      Tcl_Obj *return_obj = NULL;
-      int location = 0;
-      const char *pWhence = NULL;
-      int whence = SEEK_CUR;
-      Tcl_Size len;
-      sf_count_t count;
-
-      if( objc != 4 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "location whence"
-        );
-        return TCL_ERROR;
+    for(i = first; i < nclips && clips[i].at < t + n; i++) {
+      clip = &clips[i];
+      start = clip->at > t ? clip->at : t;
+      stop = clip->at + clip->length < t + n ? clip->at + clip->length : t + n;
+      if(stop <= start) {
+        continue;
       }
 
-      if(pSnd->sfinfo.seekable) {
-        if(Tcl_GetIntFromObj(interp, objv[2], &location) != TCL_OK) {
-            return TCL_ERROR;
+      want = clip->in + (start - clip->at);
+      if(clip->reader == NULL) {
+        clip->reader = SndRenderAcquire(interp, clip->source, want);
+        if(clip->reader == NULL) {
+          goto done;
         }
+      }
 
-        pWhence = Tcl_GetStringFromObj(objv[3], &len);
-        if( !whence || len < 1 ){
-            return TCL_ERROR;
+      reader = clip->reader;
+      if(reader->position != want) {
+        if(sf_seek(reader->sndfile, want, SEEK_SET) != want) {
+          Tcl_AppendResult(interp, "Error: ", sf_strerror(reader->sndfile), (char*)0);
+          goto done;
         }
+        reader->position = want;
+      }
 
-        //SEEK_SET  - set to the start of the audio data plus offset
-        //SEEK_CUR  - set to its current location plus offset 
-        //SEEK_END  - set to the end of the data plus offset
-        if( strcmp(pWhence, "SET")==0 ){
-          whence = SEEK_SET;
-        } else if( strcmp(pWhence, "CUR")==0 ){
-          whence = SEEK_CUR;
-        } else if( strcmp(pWhence, "END")==0 ){
-          whence = SEEK_END;
-        }
+      got = sf_readf_double(reader->sndfile, in, stop - start);
+      if(got < 0) got = 0;
+      reader->position += got;
+      if(got < stop - start) {
+        memset(in + got * channels, 0, (stop - start - got) * channels * sizeof(double));
+      }
 
-        count = sf_seek(pSnd->sndfile, (sf_count_t) location, whence);
+      SndClipGain(clip, start - clip->at, stop - start, gain);
+      SndMixGain(mix + (start - t) * channels, in, gain, stop - start, channels);
 
-        return_obj = Tcl_NewIntObj((sf_count_t) count);
-        Tcl_SetObjResult(interp, return_obj);
-      } else {
-          Tcl_SetResult(interp, (char *)"Not seekable", TCL_STATIC);
-          return TCL_ERROR;
+      if(stop == clip->at + clip->length) {
+        reader->busy = 0;
+        clip->reader = NULL;
       }
-      break;
     }
 
-    case SND_GET_STRING: {
-      Tcl_Obj *return_obj = NULL;
-      const char *pType = NULL;
-      const char *pResult = NULL;
-      int str_type = 0;
-      Tcl_Size len = 0;
+    if(sf_writef_double(out, mix, n) != n) {
+      Tcl_AppendResult(interp, "Error: ", Tcl_GetString(objv[1]), ": ", sf_strerror(out), (char*)0);
+      goto done;
+    }
+  }
 
-      if( objc != 3 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "str_type"
-        );
-        return TCL_ERROR;
-      }
+  Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) end));
+  rc = TCL_OK;
+
+done:
+  if(out) sf_close(out);
+  for(entry = Tcl_FirstHashEntry(&sources, &search); entry; entry = Tcl_NextHashEntry(&search)) {
+    src = (SndRenderSource *) Tcl_GetHashValue(entry);
+    while(src->readers) {
+      reader = src->readers;
+      src->readers = reader->next;
+      sf_close(reader->sndfile);
+      free(reader);
+    }
+    Tcl_DecrRefCount(src->pathObj);
+    free(src);
+  }
+  Tcl_DeleteHashTable(&sources);
+  if(clips) SndClipFree(clips, nclips);
+  SndBufferRelease(mixbuf);
+  SndBufferRelease(inbuf);
+  SndBufferRelease(gainbuf);
 
-      pType = Tcl_GetStringFromObj(objv[2], &len);
-      if( !pType || len < 1 ){
-        return TCL_ERROR;
-      }
+  return rc;
+}
 
-      if(pSnd->mode != SFM_READ && pSnd->mode != SFM_RDWR) {
-        return TCL_ERROR;
-      }
 
-      if( strcmp(pType, "SF_STR_TITLE")==0 ){
-        str_type = SF_STR_TITLE;
-      } else if( strcmp(pType, "SF_STR_COPYRIGHT")==0 ){
-        str_type = SF_STR_COPYRIGHT;
-      } else if( strcmp(pType, "SF_STR_SOFTWARE")==0 ){
-        str_type = SF_STR_SOFTWARE;
-      } else if( strcmp(pType, "SF_STR_ARTIST")==0 ){
-        str_type = SF_STR_ARTIST;
-      } else if( strcmp(pType, "SF_STR_COMMENT")==0 ){
-        str_type = SF_STR_COMMENT;
-      } else if( strcmp(pType, "SF_STR_DATE")==0 ){
-        str_type = SF_STR_DATE;
-      } else if( strcmp(pType, "SF_STR_ALBUM")==0 ){
-        str_type = SF_STR_ALBUM;
-      } else if( strcmp(pType, "SF_STR_LICENSE")==0 ){
-        str_type = SF_STR_LICENSE;
-      } else if( strcmp(pType, "SF_STR_TRACKNUMBER")==0 ){
-        str_type = SF_STR_TRACKNUMBER;
-      } else if( strcmp(pType, "SF_STR_GENRE")==0 ){
-        str_type = SF_STR_GENRE;
-      } else {
-        Tcl_AppendResult(interp, "unknown option: ", pType, (char*)0);
-        return TCL_ERROR;
-      }
+/*
+ * sndfile::loudness -batch paths ?-threads threads?
+ *
+ * Measure many files at once.  Each worker claims the next file, opens
+ * it and runs its own meter; the results are turned into Tcl values by
+ * the calling thread.
+ */
 
-      pResult = sf_get_string(pSnd->sndfile, str_type);
+typedef struct SndBatchItem SndBatchItem;
 
-      if(pResult) {
-         return_obj = Tcl_NewStringObj(pResult, -1);
-      } else {
-         return_obj = Tcl_NewStringObj("", 0);
-      }
+struct SndBatchItem {
+  char *path;              /* Translated file name */
+  SndLoudness ld;
+  int measured;
+  char error[256];
+};
 
-      Tcl_SetObjResult(interp, return_obj);
+typedef struct SndBatch SndBatch;
 
-      break;
-    }
+struct SndBatch {
+  Tcl_Mutex mutex;
+  void *items;
+  int count;
+  int next;
+};
 
-    case SND_SET_STRING: {
-      Tcl_Obj *return_obj = NULL;
-      const char *pType = NULL;
-      const char *pString = NULL;
-      int str_type = 0;
-      Tcl_Size len = 0;
-      int result = 0;
+/*
+ * Claim the next item of a batch, or -1 when all are taken.
+ */
+static int SndBatchNext(SndBatch *batch){
+  int index = -1;
 
-      if( objc != 4 ){
-        Tcl_WrongNumArgs(interp, 2, objv,
-          "str_type string"
-        );
-        return TCL_ERROR;
-      }
+  Tcl_MutexLock(&batch->mutex);
+  if(batch->next < batch->count) {
+    index = batch->next++;
+  }
+  Tcl_MutexUnlock(&batch->mutex);
 
-      pType = Tcl_GetStringFromObj(objv[2], &len);
-      if( !pType || len < 1 ){
-        return TCL_ERROR;
-      }
+  return index;
+}
 
-      pString = Tcl_GetStringFromObj(objv[3], &len);
-      if( !pString || len < 1 ){
-        return TCL_ERROR;
-      }
+static Tcl_Obj *SndBatchError(const char *message){
+  Tcl_Obj *value = Tcl_NewListObj(0, NULL);
 
-      if(pSnd->mode != SFM_WRITE && pSnd->mode != SFM_RDWR) {
-        return TCL_ERROR;
-      }
+  Tcl_ListObjAppendElement(NULL, value, Tcl_NewStringObj("error", -1));
+  Tcl_ListObjAppendElement(NULL, value, Tcl_NewStringObj(message, -1));
+  return value;
+}
 
-      if( strcmp(pType, "SF_STR_TITLE")==0 ){
-        str_type = SF_STR_TITLE;
-      } else if( strcmp(pType, "SF_STR_COPYRIGHT")==0 ){
-        str_type = SF_STR_COPYRIGHT;
-      } else if( strcmp(pType, "SF_STR_SOFTWARE")==0 ){
-        str_type = SF_STR_SOFTWARE;
-      } else if( strcmp(pType, "SF_STR_ARTIST")==0 ){
-        str_type = SF_STR_ARTIST;
-      } else if( strcmp(pType, "SF_STR_COMMENT")==0 ){
-        str_type = SF_STR_COMMENT;
-      } else if( strcmp(pType, "SF_STR_DATE")==0 ){
-        str_type = SF_STR_DATE;
-      } else if( strcmp(pType, "SF_STR_ALBUM")==0 ){
-        str_type = SF_STR_ALBUM;
-      } else if( strcmp(pType, "SF_STR_LICENSE")==0 ){
-        str_type = SF_STR_LICENSE;
-      } else if( strcmp(pType, "SF_STR_TRACKNUMBER")==0 ){
-        str_type = SF_STR_TRACKNUMBER;
-      } else if( strcmp(pType, "SF_STR_GENRE")==0 ){
-        str_type = SF_STR_GENRE;
-      } else {
-        Tcl_AppendResult(interp, "unknown option: ", pType, (char*)0);
-        return TCL_ERROR;
-      }
+static void SndLoudnessWorker(void *clientData){
+  SndBatch *batch = (SndBatch *) clientData;
+  SndBatchItem *item;
+  SNDFILE *sndfile;
+  SF_INFO sfinfo;
+  SndBuffer *block;
+  int index;
 
-      result = sf_set_string(pSnd->sndfile, str_type, pString);
+  while((index = SndBatchNext(batch)) >= 0) {
+    item = (SndBatchItem *) batch->items + index;
 
-      /*
-       * The sf_set_string() function sets the string data.
-       * It returns zero on success and non-zero on error.
-       */
-      return_obj = Tcl_NewIntObj(result);
-      Tcl_SetObjResult(interp, return_obj);
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    sndfile = sf_open(item->path, SFM_READ, &sfinfo);
+    if(sndfile == NULL) {
+      snprintf(item->error, sizeof(item->error), "%s", sf_strerror(NULL));
+      continue;
+    }
 
-      break;
+    block = SndBufferAlloc(SND_TYPE_DOUBLE, sfinfo.channels, SND_BLOCK_FRAMES * sfinfo.channels);
+    if(block == NULL ||
+       SndLoudnessInit(&item->ld, sfinfo.channels, sfinfo.samplerate) != TCL_OK ||
+       SndLoudnessRead(&item->ld, sndfile, (double *) block->data, SND_BLOCK_FRAMES) != TCL_OK) {
+      snprintf(item->error, sizeof(item->error), "%s", SndAllocReason());
+    } else if(sf_error(sndfile) != SF_ERR_NO_ERROR) {
+      /* The file could not be decoded to the end */
+      snprintf(item->error, sizeof(item->error), "%s", sf_strerror(sndfile));
+    } else {
+      item->measured = 1;
     }
 
-    case SND_CLOSE: {
-      int result = 0;
-      Tcl_Obj *return_obj = NULL;
+    SndBufferRelease(block);
+    sf_close(sndfile);
+  }
+}
 
-      if( objc != 2 ){
-        Tcl_WrongNumArgs(interp, 2, objv, 0);
+static int SndLoudnessCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndBatch batch;
+  SndBatchItem *items = NULL;
+  Tcl_DString translatedFilename;
+  Tcl_Obj *pathsObj = NULL;
+  Tcl_Obj **paths;
+  Tcl_Obj *pResultStr = NULL;
+  Tcl_Obj *value;
+  const char *zArg;
+  const char *zFile;
+  Tcl_Size count = 0;
+  int threads = 1;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc < 3 || (objc&1)!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "-batch paths ?-threads threads?");
+    return TCL_ERROR;
+  }
+
+  for(i = 1; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-batch")==0 ){
+      pathsObj = objv[i+1];
+    } else if( strcmp(zArg, "-threads")==0 ){
+      if(SndGetThreadsOption(interp, objv[i+1], &threads) != TCL_OK) {
         return TCL_ERROR;
       }
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
 
-      result = sf_close(pSnd->sndfile);
+  if(pathsObj == NULL) {
+    Tcl_AppendResult(interp, "Error: -batch needs a list of paths", (char*)0);
+    return TCL_ERROR;
+  }
 
-      if(pSnd->short_block) free(pSnd->short_block);
-      if(pSnd->int_block) free(pSnd->int_block);
-      if(pSnd->float_block) free(pSnd->float_block);
-      if(pSnd->double_block) free(pSnd->double_block);
-      Tcl_Free((char *)pSnd);
-      pSnd = NULL;
+  if(Tcl_ListObjGetElements(interp, pathsObj, &count, &paths) != TCL_OK) {
+    return TCL_ERROR;
+  }
 
-      Tcl_DeleteCommand(interp, Tcl_GetStringFromObj(objv[0], 0));
+  memset(&batch, 0, sizeof(batch));
+  batch.count = (int) count;
+  if(count > 0) {
+    items = (SndBatchItem *) calloc(count, sizeof(SndBatchItem));
+    if(items == NULL) {
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return TCL_ERROR;
+    }
+  }
+  batch.items = items;
 
-      return_obj = Tcl_NewIntObj(result);
-      Tcl_SetObjResult(interp, return_obj);
-      break;
+  for(i = 0; i < batch.count; i++) {
+    zFile = Tcl_TranslateFileName(interp, Tcl_GetString(paths[i]), &translatedFilename);
+    if(zFile == NULL) {
+      goto done;
     }
+    items[i].path = strdup(zFile);
+    Tcl_DStringFree(&translatedFilename);
+  }
 
-  } /* End of the SWITCH statement */
+  if(threads > batch.count) threads = batch.count > 0 ? batch.count : 1;
+  SndRunWorkers(threads, SndLoudnessWorker, &batch);
+
+  pResultStr = Tcl_NewListObj(0, NULL);
+  for(i = 0; i < batch.count; i++) {
+    if(items[i].measured) {
+      value = SndLoudnessResult(&items[i].ld);
+    } else {
+      value = SndBatchError(items[i].error);
+    }
+    Tcl_ListObjAppendElement(NULL, pResultStr, paths[i]);
+    Tcl_ListObjAppendElement(NULL, pResultStr, value);
+  }
+
+  Tcl_SetObjResult(interp, pResultStr);
+  rc = TCL_OK;
+
+done:
+  for(i = 0; i < batch.count; i++) {
+    free(items[i].path);
+    SndLoudnessFree(&items[i].ld);
+  }
+  free(items);
+  Tcl_MutexFinalize(&batch.mutex);
 
   return rc;
 }
 
 
-static int SndMain(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
-  SndFileData *p;
-  const char *zArg;
-  int i = 0;
-  const char *zFile = NULL;
-  const char *zMode = NULL;
-  char *fileformat = NULL;
-  char *encoding = NULL;
-  int samplerate = 44100;
-  int channels = 2;
+/*
+ * sndfile::digest path ?-algo algo? ?-type type? ?-verify boolean?
+ * sndfile::digest -batch paths ?-threads threads? ?option value ...?
+ */
+
+typedef struct SndDigestJob SndDigestJob;
+
+struct SndDigestJob {
+  SndBatch batch;
+  int algo;
+  int type;
+  int verify;
+};
+
+static void SndDigestWorker(void *clientData){
+  SndDigestJob *job = (SndDigestJob *) clientData;
+  int index;
+
+  while((index = SndBatchNext(&job->batch)) >= 0) {
+    SndDigestFile((SndDigestItem *) job->batch.items + index, job->algo, job->type, job->verify);
+  }
+}
+
+static Tcl_Obj *SndDigestResult(SndDigestItem *item, int verify){
+  static const char hex[] = "0123456789abcdef";
+  Tcl_Obj *pResultStr = Tcl_NewListObj(0, NULL);
+  char text[65];
+  int i;
+
+  for(i = 0; i < item->length; i++) {
+    text[2 * i] = hex[item->digest[i] >> 4];
+    text[2 * i + 1] = hex[item->digest[i] & 15];
+  }
+
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("digest", -1));
+  Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj(text, 2 * item->length));
+  if(verify) {
+    Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewStringObj("verified", -1));
+    if(item->verified < 0) {
+      Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewObj());
+    } else {
+      Tcl_ListObjAppendElement(NULL, pResultStr, Tcl_NewBooleanObj(item->verified));
+    }
+  }
+
+  return pResultStr;
+}
+
+static int SndDigestCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  SndDigestJob job;
+  SndDigestItem *items = NULL;
   Tcl_DString translatedFilename;
-  int buffersize = 0;
+  Tcl_Obj *pathObj = NULL;
+  Tcl_Obj *batchObj = NULL;
+  Tcl_Obj **paths;
   Tcl_Obj *pResultStr = NULL;
-  Tcl_Size len;
+  const char *zArg;
+  const char *zFile;
+  Tcl_Size count = 0;
+  int threads = 1;
+  int first = 1;
+  int i;
+  int rc = TCL_ERROR;
+
+  if( objc >= 2 && (objc&1)==0 ){
+    pathObj = objv[1];
+    first = 2;
+  }
+
+  if( objc < 2 || ((objc - first)&1)!=0 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "path|-batch paths ?-algo algo? ?-type type? ?-verify boolean? ?-threads threads?");
+    return TCL_ERROR;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.algo = SND_DIGEST_XXH64;
+  job.type = SND_TYPE_INT;
+
+  for(i = first; i+1 < objc; i += 2){
+    zArg = Tcl_GetStringFromObj(objv[i], 0);
+
+    if( strcmp(zArg, "-algo")==0 ){
+      if( Tcl_GetIndexFromObj(interp, objv[i+1], sndDigestNames, "algo", 0, &job.algo) ){
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-type")==0 ){
+      if( Tcl_GetIndexFromObj(interp, objv[i+1], sndTypeNames, "type", 0, &job.type) ){
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-verify")==0 ){
+      if(Tcl_GetBooleanFromObj(interp, objv[i+1], &job.verify) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else if( strcmp(zArg, "-batch")==0 ){
+      batchObj = objv[i+1];
+    } else if( strcmp(zArg, "-threads")==0 ){
+      if(SndGetThreadsOption(interp, objv[i+1], &threads) != TCL_OK) {
+        return TCL_ERROR;
+      }
+    } else {
+      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
+      return TCL_ERROR;
+    }
+  }
 
-  if( objc<4 || (objc&1)!=0 ){
-    Tcl_WrongNumArgs(interp, 1, objv,
-      "HANDLE path mode ?-buffersize size? ?-rate samplerate? ?-channels channels? ?-fileformat format? ?-encoding encoding_type? "
-    );
+  if((pathObj == NULL) == (batchObj == NULL)) {
+    Tcl_AppendResult(interp, "Error: needs either a path or -batch", (char*)0);
     return TCL_ERROR;
   }
 
-  p = (SndFileData *)Tcl_Alloc( sizeof(*p) );
-  if( p==0 ){
-    Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+  if(job.verify && job.type != SND_TYPE_INT) {
+    Tcl_AppendResult(interp, "Error: -verify needs -type int", (char*)0);
     return TCL_ERROR;
   }
 
-  memset(p, 0, sizeof(*p));
-  p->interp = interp;
-
-  zFile = Tcl_GetStringFromObj(objv[2], &len);
-  if( !zFile || len < 1 ){
-    Tcl_Free((char *)p);
+  if(pathObj) {
+    paths = &pathObj;
+    count = 1;
+  } else if(Tcl_ListObjGetElements(interp, batchObj, &count, &paths) != TCL_OK) {
     return TCL_ERROR;
   }
 
-  zMode = Tcl_GetStringFromObj(objv[3], &len);
-  if( !zMode || len < 1 ){
-    Tcl_Free((char *)p);
+  job.batch.count = (int) count;
+  if(count > 0) {
+    items = (SndDigestItem *) calloc(count, sizeof(SndDigestItem));
+    if(items == NULL) {
+      Tcl_SetResult(interp, (char *)"malloc failed", TCL_STATIC);
+      return TCL_ERROR;
+    }
+  }
+  job.batch.items = items;
 
-    Tcl_AppendResult(interp, "Error: correct mode is READ, WRITE and RDWR", (char*)0);
-    return TCL_ERROR;
+  for(i = 0; i < job.batch.count; i++) {
+    zFile = Tcl_TranslateFileName(interp, Tcl_GetString(paths[i]), &translatedFilename);
+    if(zFile == NULL) {
+      goto done;
+    }
+    items[i].path = strdup(zFile);
+    Tcl_DStringFree(&translatedFilename);
   }
 
-  //SFM_READ    - read only mode
-  //SFM_WRITE   - write only mode
-  //SFM_RDWR    - read/write mode
-  if( strcmp(zMode, "READ")==0 ){
-    p->mode = SFM_READ;
-  } else if( strcmp(zMode, "WRITE")==0 ){
-    p->mode = SFM_WRITE;
-  } else if( strcmp(zMode, "RDWR")==0 ){
-    p->mode = SFM_RDWR;
-  } else {
-    Tcl_Free((char *)p);
+  if(pathObj) {
+    if(SndDigestFile(&items[0], job.algo, job.type, job.verify) != TCL_OK) {
+      Tcl_AppendResult(interp, "Error: ", Tcl_GetString(pathObj), ": ", items[0].error, (char*)0);
+      goto done;
+    }
+    Tcl_SetObjResult(interp, SndDigestResult(&items[0], job.verify));
+    rc = TCL_OK;
+    goto done;
+  }
 
-    Tcl_AppendResult(interp, "Error: correct mode is READ, WRITE and RDWR", (char*)0);
-    return TCL_ERROR;
+  if(threads > job.batch.count) threads = job.batch.count > 0 ? job.batch.count : 1;
+  SndRunWorkers(threads, SndDigestWorker, &job);
+
+  pResultStr = Tcl_NewListObj(0, NULL);
+  for(i = 0; i < job.batch.count; i++) {
+    Tcl_ListObjAppendElement(NULL, pResultStr, paths[i]);
+    if(items[i].error[0]) {
+      Tcl_ListObjAppendElement(NULL, pResultStr, SndBatchError(items[i].error));
+    } else {
+      Tcl_ListObjAppendElement(NULL, pResultStr, SndDigestResult(&items[i], job.verify));
+    }
   }
 
-  for(i=4; i+1<objc; i+=2){
-    zArg = Tcl_GetStringFromObj(objv[i], 0);
+  Tcl_SetObjResult(interp, pResultStr);
+  rc = TCL_OK;
 
-    if( strcmp(zArg, "-buffersize")==0 ){
-      if(Tcl_GetIntFromObj(interp, objv[i+1], &buffersize) != TCL_OK) {
-         Tcl_Free((char *)p);
-         return TCL_ERROR;
-      }
+done:
+  for(i = 0; i < job.batch.count; i++) {
+    free(items[i].path);
+  }
+  free(items);
+  Tcl_MutexFinalize(&job.batch.mutex);
 
-      if(buffersize <= 0) {
-         Tcl_Free((char *)p);
-         Tcl_AppendResult(interp, "Error: buffersize needs > 0", (char*)0);
-         return TCL_ERROR;
+  return rc;
+}
+
+
+/*
+ * sndfile::configure ?option? ?value option value ...?
+ *
+ * Settings of the buffer memory shared by all handles of the process.
+ */
+static Tcl_Obj *SndMemoryGet(int option){
+  Tcl_Obj *objPtr = NULL;
+
+  Tcl_MutexLock(&myMutex);
+  switch(option) {
+    case SND_MEMORY_MAXBYTES:
+      objPtr = Tcl_NewWideIntObj(sndMemory.maxbytes);
+      break;
+    case SND_MEMORY_DEFAULTFRAMES:
+      objPtr = Tcl_NewIntObj(sndMemory.defaultframes);
+      break;
+    case SND_MEMORY_ONLIMIT:
+      objPtr = Tcl_NewStringObj(sndOnLimitNames[sndMemory.onlimit], -1);
+      break;
+  }
+  Tcl_MutexUnlock(&myMutex);
+
+  return objPtr;
+}
+
+static int SndMemorySet(Tcl_Interp *interp, int option, Tcl_Obj *valueObj){
+  Tcl_WideInt maxbytes = 0, keep = -1;
+  int frames = 0;
+  int onlimit = 0;
+
+  switch(option) {
+    case SND_MEMORY_MAXBYTES:
+      if(Tcl_GetWideIntFromObj(interp, valueObj, &maxbytes) != TCL_OK) {
+        return TCL_ERROR;
+      }
+      if(maxbytes < 0) {
+        Tcl_AppendResult(interp, "Error: maxbufferbytes needs >= 0", (char*)0);
+        return TCL_ERROR;
       }
 
+      /* Buffers already allocated stay, only new ones are refused */
       Tcl_MutexLock(&myMutex);
-      p->buffersize = buffersize;
-      p->buff_init = 1;
+      sndMemory.maxbytes = maxbytes;
+      if(maxbytes > 0) {
+        keep = maxbytes > sndMemory.used ? maxbytes - sndMemory.used : 0;
+      }
       Tcl_MutexUnlock(&myMutex);
-    } else if( strcmp(zArg, "-rate")==0 ){
-      if(Tcl_GetIntFromObj(interp, objv[i+1], &samplerate) != TCL_OK) {
-         Tcl_Free((char *)p);
-         return TCL_ERROR;
+      if(keep >= 0) {
+        SndPoolTrim(keep);
       }
+      break;
 
-      if(samplerate <= 0) {
-         Tcl_Free((char *)p);
-         Tcl_AppendResult(interp, "Error: samplerate needs > 0", (char*)0);
-         return TCL_ERROR;
-      }
-    } else if( strcmp(zArg, "-channels")==0 ){
-      if(Tcl_GetIntFromObj(interp, objv[i+1], &channels) != TCL_OK) {
-         Tcl_Free((char *)p);
-         return TCL_ERROR;
-      }
-      
-      if(channels <= 0) {
-         Tcl_Free((char *)p);
-         Tcl_AppendResult(interp, "Error: channels needs > 0", (char*)0);
-         return TCL_ERROR;
+    case SND_MEMORY_DEFAULTFRAMES:
+      if(Tcl_GetIntFromObj(interp, valueObj, &frames) != TCL_OK) {
+        return TCL_ERROR;
       }
-    } else if( strcmp(zArg, "-fileformat")==0 ){
-      fileformat = Tcl_GetStringFromObj(objv[i+1], &len);
-      if( !fileformat || len < 1 ){
-         Tcl_Free((char *)p);
-         return TCL_ERROR;
+      if(frames < 0) {
+        Tcl_AppendResult(interp, "Error: defaultbufferframes needs >= 0", (char*)0);
+        return TCL_ERROR;
       }
-    } else if( strcmp(zArg, "-encoding")==0 ){
-      encoding = Tcl_GetStringFromObj(objv[i+1], &len);
-      if( !encoding || len < 1 ){
-         Tcl_Free((char *)p);
-         return TCL_ERROR;
+
+      Tcl_MutexLock(&myMutex);
+      sndMemory.defaultframes = frames;
+      Tcl_MutexUnlock(&myMutex);
+      break;
+
+    case SND_MEMORY_ONLIMIT:
+      if( Tcl_GetIndexFromObj(interp, valueObj, sndOnLimitNames, "onlimit", 0, &onlimit) ){
+        return TCL_ERROR;
       }
-    }else{
-      Tcl_Free((char *)p);
 
-      Tcl_AppendResult(interp, "unknown option: ", zArg, (char*)0);
-      return TCL_ERROR;
-    }
+      Tcl_MutexLock(&myMutex);
+      sndMemory.onlimit = onlimit;
+      Tcl_MutexUnlock(&myMutex);
+      break;
   }
 
-  if(p->mode != SFM_READ) {
-    if(!fileformat || !encoding) {
-      Tcl_Free((char *)p);
-
-      Tcl_AppendResult(interp, "Error: fileformat and encoding need specify a value", (char*)0);
-      return TCL_ERROR;
-    }
+  return TCL_OK;
+}
 
-    p->sfinfo.samplerate = samplerate;
-    p->sfinfo.channels = channels;  
+static int SndConfigureCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  Tcl_Obj *return_obj = NULL;
+  int option = 0;
+  int i = 0;
 
-    if(strcmp(fileformat, "wav")==0) {
-        p->sfinfo.format |= SF_FORMAT_WAV;
-    } else if(strcmp(fileformat, "aiff")==0) {
-        p->sfinfo.format |= SF_FORMAT_AIFF;
-    } else if(strcmp(fileformat, "au")==0) {
-        p->sfinfo.format |= SF_FORMAT_AU;
-    } else if(strcmp(fileformat, "raw")==0) {
-        p->sfinfo.format |= SF_FORMAT_RAW;
-    } else if(strcmp(fileformat, "paf")==0) {
-        p->sfinfo.format |= SF_FORMAT_PAF;
-    } else if(strcmp(fileformat, "svx")==0) {
-        p->sfinfo.format |= SF_FORMAT_SVX;
-    } else if(strcmp(fileformat, "nist")==0) {
-        p->sfinfo.format |= SF_FORMAT_NIST;
-    } else if(strcmp(fileformat, "voc")==0) {
-        p->sfinfo.format |= SF_FORMAT_VOC;
-    } else if(strcmp(fileformat, "ircam")==0) {
-        p->sfinfo.format |= SF_FORMAT_IRCAM;
-    } else if(strcmp(fileformat, "w64")==0) {
-        p->sfinfo.format |= SF_FORMAT_W64;
-    } else if(strcmp(fileformat, "mat4")==0) {
-        p->sfinfo.format |= SF_FORMAT_MAT4;
-    } else if(strcmp(fileformat, "mat5")==0) {
-        p->sfinfo.format |= SF_FORMAT_MAT5;
-    } else if(strcmp(fileformat, "pvf")==0) {
-        p->sfinfo.format |= SF_FORMAT_PVF;
-    } else if(strcmp(fileformat, "xi")==0) {
-        p->sfinfo.format |= SF_FORMAT_XI;
-    } else if(strcmp(fileformat, "htk")==0) {
-        p->sfinfo.format |= SF_FORMAT_HTK;
-    } else if(strcmp(fileformat, "sds")==0) {
-        p->sfinfo.format |= SF_FORMAT_SDS;
-    } else if(strcmp(fileformat, "avr")==0) {
-        p->sfinfo.format |= SF_FORMAT_AVR;
-    } else if(strcmp(fileformat, "wavex")==0) {
-        p->sfinfo.format |= SF_FORMAT_WAVEX;
-    } else if(strcmp(fileformat, "sd2")==0) {
-        p->sfinfo.format |= SF_FORMAT_SD2;
-    } else if(strcmp(fileformat, "flac")==0) {
-        p->sfinfo.format |= SF_FORMAT_FLAC;
-    } else if(strcmp(fileformat, "caf")==0) {
-        p->sfinfo.format |= SF_FORMAT_CAF;
-    } else if(strcmp(fileformat, "wve")==0) {
-        p->sfinfo.format |= SF_FORMAT_WVE;
-    } else if(strcmp(fileformat, "ogg")==0) {
-        p->sfinfo.format |= SF_FORMAT_OGG;
-    } else if(strcmp(fileformat, "mpc2k")==0) {
-        p->sfinfo.format |= SF_FORMAT_MPC2K;
-    } else if(strcmp(fileformat, "rf64")==0) {
-        p->sfinfo.format |= SF_FORMAT_RF64;
-    } else {
-       Tcl_Free((char *)p);
+  if( objc > 2 && (objc&1)!=1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, "?option? ?value option value ...?");
+    return TCL_ERROR;
+  }
 
-       Tcl_AppendResult(interp, "fileformat unknown option", (char*)0);
-       return TCL_ERROR;
+  if( objc == 1 ){
+    return_obj = Tcl_NewListObj(0, NULL);
+    for(i = 0; sndMemoryStrs[i]; i++) {
+      Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewStringObj(sndMemoryStrs[i], -1));
+      Tcl_ListObjAppendElement(interp, return_obj, SndMemoryGet(i));
     }
+    Tcl_SetObjResult(interp, return_obj);
+    return TCL_OK;
+  }
 
-    if(strcmp(encoding, "pcm_16")==0) {
-        p->sfinfo.format |= SF_FORMAT_PCM_16;
-    } else if(strcmp(encoding, "pcm_24")==0) {
-        p->sfinfo.format |= SF_FORMAT_PCM_24;
-    } else if(strcmp(encoding, "pcm_32")==0) {
-        p->sfinfo.format |= SF_FORMAT_PCM_32;
-    } else if(strcmp(encoding, "pcm_s8")==0) {
-        p->sfinfo.format |= SF_FORMAT_PCM_S8;
-    } else if(strcmp(encoding, "pcm_u8")==0) {
-        p->sfinfo.format |= SF_FORMAT_PCM_U8;
-    } else if(strcmp(encoding, "float")==0) {
-        p->sfinfo.format |= SF_FORMAT_FLOAT;
-    } else if(strcmp(encoding, "double")==0) {
-        p->sfinfo.format |= SF_FORMAT_DOUBLE;
-    } else if(strcmp(encoding, "ulaw")==0) {
-        p->sfinfo.format |= SF_FORMAT_ULAW;
-    } else if(strcmp(encoding, "alaw")==0) {
-        p->sfinfo.format |= SF_FORMAT_ALAW;
-    } else if(strcmp(encoding, "ima_adpcm")==0) {
-        p->sfinfo.format |= SF_FORMAT_IMA_ADPCM;
-    } else if(strcmp(encoding, "ms_adpcm")==0) {
-        p->sfinfo.format |= SF_FORMAT_MS_ADPCM;
-    } else if(strcmp(encoding, "gsm610")==0) {
-        p->sfinfo.format |= SF_FORMAT_GSM610;
-    } else if(strcmp(encoding, "vox_adpcm")==0) {
-        p->sfinfo.format |= SF_FORMAT_VOX_ADPCM;
-    } else if(strcmp(encoding, "g721_32")==0) {
-        p->sfinfo.format |= SF_FORMAT_G721_32;
-    } else if(strcmp(encoding, "g723_24")==0) {
-        p->sfinfo.format |= SF_FORMAT_G723_24;
-    } else if(strcmp(encoding, "g723_40")==0) {
-        p->sfinfo.format |= SF_FORMAT_G723_40;
-    } else if(strcmp(encoding, "dwvw_12")==0) {
-        p->sfinfo.format |= SF_FORMAT_DWVW_12;
-    } else if(strcmp(encoding, "dwvw_16")==0) {
-        p->sfinfo.format |= SF_FORMAT_DWVW_16;
-    } else if(strcmp(encoding, "dwvw_24")==0) {
-        p->sfinfo.format |= SF_FORMAT_DWVW_24;
-    } else if(strcmp(encoding, "dwvw_n")==0) {
-        p->sfinfo.format |= SF_FORMAT_DWVW_N;
-    } else if(strcmp(encoding, "dpcm_8")==0) {
-        p->sfinfo.format |= SF_FORMAT_DPCM_8;
-    } else if(strcmp(encoding, "dpcm_16")==0) {
-        p->sfinfo.format |= SF_FORMAT_DPCM_16;
-    } else if(strcmp(encoding, "vorbis")==0) {
-        p->sfinfo.format |= SF_FORMAT_VORBIS;
-    } else {
-       Tcl_Free((char *)p);
-
-       Tcl_AppendResult(interp, "encoding unknown option", (char*)0);
-       return TCL_ERROR;
+  if( objc == 2 ){
+    if( Tcl_GetIndexFromObj(interp, objv[1], sndMemoryStrs, "option", 0, &option) ){
+      return TCL_ERROR;
     }
+    Tcl_SetObjResult(interp, SndMemoryGet(option));
+    return TCL_OK;
   }
 
-  zFile = Tcl_TranslateFileName(interp, zFile, &translatedFilename);
-  p->sndfile = sf_open(zFile, p->mode, & (p->sfinfo));
-  Tcl_DStringFree(&translatedFilename);
-
-  if(p->sndfile == NULL) {
-      Tcl_Free((char *)p);  //open fail, so we need free our memory
-      p = NULL;
+  for(i = 1; i+1 < objc; i += 2){
+    if( Tcl_GetIndexFromObj(interp, objv[i], sndMemoryStrs, "option", 0, &option) ){
+      return TCL_ERROR;
+    }
 
+    if(SndMemorySet(interp, option, objv[i+1]) != TCL_OK) {
       return TCL_ERROR;
+    }
   }
 
-  p->short_block = NULL;
-  p->int_block = NULL;
-  p->float_block = NULL;
-  p->double_block = NULL;
+  return TCL_OK;
+}
 
-  switch (p->sfinfo.format & SF_FORMAT_TYPEMASK) {
-      case SF_FORMAT_WAV:
-          fileformat = "wav";
-          break;
-      case SF_FORMAT_AIFF:
-          fileformat = "aiff";
-          break;
-      case SF_FORMAT_AU:
-          fileformat = "au";
-          break;
-      case SF_FORMAT_RAW:
-          fileformat = "raw";
-          break;
-      case SF_FORMAT_PAF:
-          fileformat = "paf";
-          break;
-      case SF_FORMAT_SVX:
-          fileformat = "svx";
-          break;
-      case SF_FORMAT_NIST:
-          fileformat = "nist";
-          break;
-      case SF_FORMAT_VOC:
-          fileformat = "voc";
-          break;
-      case SF_FORMAT_IRCAM:
-          fileformat = "ircam";
-          break;
-      case SF_FORMAT_W64:
-          fileformat = "w64";
-          break;
-      case SF_FORMAT_MAT4:
-          fileformat = "mat4";
-          break;
-      case SF_FORMAT_MAT5:
-          fileformat = "mat5";
-          break;
-      case SF_FORMAT_PVF:
-          fileformat = "pvf";
-          break;
-      case SF_FORMAT_XI:
-          fileformat = "xi";
-          break;
-      case SF_FORMAT_HTK:
-          fileformat = "htk";
-          break;
-      case SF_FORMAT_SDS:
-          fileformat = "sds";
-          break;
-      case SF_FORMAT_AVR:
-          fileformat = "avr";
-          break;
-      case SF_FORMAT_WAVEX:
-          fileformat = "wavex";
-          break;
-      case SF_FORMAT_SD2:
-          fileformat = "sd2";
-          break;
-      case SF_FORMAT_FLAC:
-          fileformat = "flac";
-          break;
-      case SF_FORMAT_CAF:
-          fileformat = "caf";
-          break;
-      case SF_FORMAT_WVE:
-          fileformat = "wve";
-          break;
-      case SF_FORMAT_OGG:
-          fileformat = "ogg";
-          break;
-      case SF_FORMAT_MPC2K:
-          fileformat = "mpc2k";
-          break;
-      case SF_FORMAT_RF64:
-          fileformat = "rf64";
-          break;
-      default:
-          fileformat = "unknown";
-          break;
-  }
 
-  switch (p->sfinfo.format & SF_FORMAT_SUBMASK) {
-      case SF_FORMAT_PCM_16:
-          encoding = "pcm_16";
-          break;
-      case SF_FORMAT_PCM_24:
-          encoding = "pcm_24";
-          break;
-      case SF_FORMAT_PCM_32:
-          encoding = "pcm_32";
-          break;
-      case SF_FORMAT_PCM_S8:
-          encoding = "pcm_s8";
-          break;
-      case SF_FORMAT_PCM_U8:
-          encoding = "pcm_u8";
-          break;
-      case SF_FORMAT_FLOAT:
-          encoding = "float";
-          break;
-      case SF_FORMAT_DOUBLE:
-          encoding = "double";
-          break;
-      case SF_FORMAT_ULAW:
-          encoding = "ulaw";
-          break;
-      case SF_FORMAT_ALAW:
-          encoding = "alaw";
-          break;
-      case SF_FORMAT_IMA_ADPCM:
-          encoding = "ima_adpcm";
-          break;
-      case SF_FORMAT_MS_ADPCM:
-          encoding = "ms_adpcm";
-          break;
-      case SF_FORMAT_GSM610:
-          encoding = "gsm610";
-          break;
-      case SF_FORMAT_VOX_ADPCM:
-          encoding = "vox_adpcm";
-          break;
-      case SF_FORMAT_G721_32:
-          encoding = "g721_32";
-          break;
-      case SF_FORMAT_G723_24:
-          encoding = "g723_24";
-          break;
-      case SF_FORMAT_G723_40:
-          encoding = "g723_40";
-          break;
-      case SF_FORMAT_DWVW_12:
-          encoding = "dwvw_12";
-          break;
-      case SF_FORMAT_DWVW_16:
-          encoding = "dwvw_16";
-          break;
-      case SF_FORMAT_DWVW_24:
-          encoding = "dwvw_24";
-          break;
-      case SF_FORMAT_DWVW_N:
-          encoding = "dwvw_n";
-          break;
-      case SF_FORMAT_DPCM_8:
-          encoding = "dpcm_8";
-          break;
-      case SF_FORMAT_DPCM_16:
-          encoding = "dpcm_16";
-          break;
-      case SF_FORMAT_VORBIS:
-          encoding = "vorbis";
-          break;
-      default:
-          encoding = "unknown";
-          break;
-  }
+/*
+ * sndfile::memory
+ *
+ * Buffer memory use of the process, as a dict.  "used" holds the sample
+ * buffers, which include the blocks of the file commands, the -parallel
+ * slots and the queued onwritable writes, and the working memory counted
+ * by SndMemoryCharge: undrained -memory bytes, FFT tables and loudness
+ * state.  Small fixed structures like handles and clip lists are not
+ * counted.
+ */
+static int SndMemoryCmd(void *cd, Tcl_Interp *interp, int objc,Tcl_Obj *const*objv){
+  Tcl_Obj *return_obj = NULL;
+  Tcl_WideInt values[10];
+  static const char *names[] = {
+    "maxbufferbytes", "used", "peak", "pooled", "buffers", "handles",
+    "allocs", "reuses", "shrinks", "failures", 0
+  };
+  int i = 0;
 
-  zArg = Tcl_GetStringFromObj(objv[1], 0);
-  Tcl_CreateObjCommand(interp, zArg, SndObjCmd, (char*)p, (Tcl_CmdDeleteProc *)NULL);
+  if( objc != 1 ){
+    Tcl_WrongNumArgs(interp, 1, objv, 0);
+    return TCL_ERROR;
+  }
 
-  /*
-   * sfinfo.frames is used to be called samples, not sure is OK for WRITE.
-   */
-  pResultStr = Tcl_NewListObj(0, NULL);
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("frames", -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(p->sfinfo.frames));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("fileformat", -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(fileformat, -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("encoding", -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj(encoding, -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("samplerate", -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(p->sfinfo.samplerate));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewStringObj("channels", -1));
-  Tcl_ListObjAppendElement(interp, pResultStr, Tcl_NewIntObj(p->sfinfo.channels));
+  Tcl_MutexLock(&myMutex);
+  values[0] = sndMemory.maxbytes;
+  values[1] = sndMemory.used;
+  values[2] = sndMemory.peak;
+  values[3] = sndMemory.pooled;
+  values[4] = sndMemory.buffers;
+  values[5] = sndMemory.handles;
+  values[6] = sndMemory.allocs;
+  values[7] = sndMemory.reuses;
+  values[8] = sndMemory.shrinks;
+  values[9] = sndMemory.failures;
+  Tcl_MutexUnlock(&myMutex);
+
+  return_obj = Tcl_NewListObj(0, NULL);
+  for(i = 0; names[i]; i++) {
+    Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewStringObj(names[i], -1));
+    Tcl_ListObjAppendElement(interp, return_obj, Tcl_NewWideIntObj(values[i]));
+  }
+  Tcl_SetObjResult(interp, return_obj);
 
-  Tcl_SetObjResult(interp, pResultStr);  
   return TCL_OK;
 }
 
@@ -1044,8 +7734,47 @@ Sndfile_Init(Tcl_Interp *interp)
 	return TCL_ERROR;
     }
 
+    Tcl_RegisterObjType(&sndBufferType);
+
+    Tcl_MutexLock(&myMutex);
+    if(!sndPoolExitHandler) {
+      sndPoolExitHandler = 1;
+      Tcl_CreateExitHandler(SndPoolExitHandler, NULL);
+    }
+    Tcl_MutexUnlock(&myMutex);
+
     Tcl_CreateObjCommand(interp, "sndfile", (Tcl_ObjCmdProc *) SndMain,
         (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
 
+    Tcl_CreateObjCommand(interp, "sndfile::buffer", (Tcl_ObjCmdProc *) SndBufferCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::trim", (Tcl_ObjCmdProc *) SndTrimCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::split", (Tcl_ObjCmdProc *) SndSplitCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::concat", (Tcl_ObjCmdProc *) SndConcatCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::convert", (Tcl_ObjCmdProc *) SndConvertCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::render", (Tcl_ObjCmdProc *) SndRenderCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::loudness", (Tcl_ObjCmdProc *) SndLoudnessCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::digest", (Tcl_ObjCmdProc *) SndDigestCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::configure", (Tcl_ObjCmdProc *) SndConfigureCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
+    Tcl_CreateObjCommand(interp, "sndfile::memory", (Tcl_ObjCmdProc *) SndMemoryCmd,
+        (ClientData)NULL, (Tcl_CmdDeleteProc *)NULL);
+
     return TCL_OK;
 }
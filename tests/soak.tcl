@@ -0,0 +1,246 @@
+# soak.tcl --
+#
+#	Soak and scaling benchmark for tclsndfile.  Opens -handles handles
+#	at the same time, spread over T Thread package interpreters for each
+#	T in -threads, and streams every handle to the end of a locally
+#	generated file, optionally writing it back to a -memory handle.
+#	For each T it reports the throughput and its scaling against the
+#	first T, the block bytes per handle, the buffer allocations and a
+#	leak check: after the threads are gone no handle and no buffer may
+#	be left.  Exits with 1 when a check fails.
+#
+#	make soak SOAKFLAGS="-handles 1000 -threads {1 2 4 8 16}"
+#	make valgrind-soak
+#------------------------------------------------------------------------------
+
+package require Thread
+
+array set opts {
+    -handles 64
+    -threads {1 2 4 8}
+    -files 4
+    -seconds 2
+    -rate 48000
+    -channels 2
+    -type float
+    -write 1
+    -defaultbufferframes 0
+    -maxbufferbytes 0
+    -onlimit error
+    -dir soak_files
+    -load {}
+}
+
+if {[llength $argv] % 2} {
+    puts stderr "usage: soak.tcl ?-option value ...?"
+    puts stderr "options: [lsort [array names opts]]"
+    exit 2
+}
+foreach {key value} $argv {
+    if {![info exists opts($key)]} {
+        puts stderr "unknown option \"$key\", must be one of: [lsort [array names opts]]"
+        exit 2
+    }
+    set opts($key) $value
+}
+
+# -load is the same script as for all.tcl, usually a "package ifneeded"
+eval $opts(-load)
+package require sndfile
+
+sndfile::configure -defaultbufferframes $opts(-defaultbufferframes) \
+    -maxbufferbytes $opts(-maxbufferbytes) -onlimit $opts(-onlimit)
+
+
+#-------------------------------------------------------------------------------
+# Source files: a sine of a different pitch per file
+
+proc makeFiles {} {
+    global opts
+
+    file mkdir $opts(-dir)
+    set paths {}
+    set frames [expr {int($opts(-seconds) * $opts(-rate))}]
+    for {set f 0} {$f < $opts(-files)} {incr f} {
+        set path [file join $opts(-dir) src$f.wav]
+        set step [expr {2 * acos(-1) * (220.0 + 110.0 * $f) / $opts(-rate)}]
+        sndfile gen $path WRITE -rate $opts(-rate) -channels $opts(-channels) \
+            -fileformat wav -encoding pcm_16
+        for {set i 0} {$i < $frames} {incr i 4096} {
+            set samples {}
+            for {set j $i} {$j < $i + 4096 && $j < $frames} {incr j} {
+                set v [expr {0.5 * sin($step * $j)}]
+                for {set c 0} {$c < $opts(-channels)} {incr c} {
+                    lappend samples $v
+                }
+            }
+            gen write_float [binary format f* $samples]
+        }
+        gen close
+        lappend paths [file normalize $path]
+    }
+    return $paths
+}
+
+
+#-------------------------------------------------------------------------------
+# Worker: runs in each thread interpreter
+
+set worker {
+    # Open all handles first, then read them round robin so that they
+    # are all live at the same time.
+    proc soak {paths n type write rate channels} {
+        set live {}
+        set errors {}
+        for {set i 0} {$i < $n} {incr i} {
+            set r soakr$i
+            set w {}
+            sndfile $r [lindex $paths [expr {$i % [llength $paths]}]] READ
+            if {$write} {
+                set w soakw$i
+                sndfile $w mem WRITE -memory 1 -rate $rate -channels $channels \
+                    -fileformat au -encoding pcm_16
+            }
+            lappend live $r $w
+        }
+
+        set frames 0
+        set bytes 0
+        set first 1
+        while {[llength $live]} {
+            set next {}
+            foreach {r w} $live {
+                if {[catch {$r read_$type} buf] ||
+                    [set k [dict get [sndfile::buffer info $buf] frames]] == 0} {
+                    if {$buf ne ""} {
+                        lappend errors "$r: $buf"
+                    }
+                    $r close
+                    if {$w ne ""} {
+                        $w drain -final
+                        $w close
+                    }
+                    continue
+                }
+                incr frames $k
+                if {$w ne ""} {
+                    $w write_$type $buf
+                    $w drain
+                }
+                lappend next $r $w
+            }
+
+            # Block bytes while every handle is open and has read once
+            if {$first} {
+                foreach {r w} $next {
+                    incr bytes [dict get [$r memory] bytes]
+                    if {$w ne ""} {
+                        incr bytes [dict get [$w memory] bytes]
+                    }
+                }
+                set first 0
+            }
+            set live $next
+        }
+
+        return [list frames $frames bytes $bytes errors $errors]
+    }
+}
+
+
+#-------------------------------------------------------------------------------
+# One round: -handles handles over "nthreads" threads
+
+proc round {paths nthreads} {
+    global opts worker
+
+    set tids {}
+    for {set t 0} {$t < $nthreads} {incr t} {
+        set tid [thread::create -joinable]
+        thread::send $tid $opts(-load)
+        thread::send $tid {package require sndfile}
+        thread::send $tid $worker
+        lappend tids $tid
+    }
+
+    set before [sndfile::memory]
+    set start [clock microseconds]
+    set pending 0
+    foreach tid $tids {
+        # Spread the remainder over the first threads
+        set n [expr {$opts(-handles) / $nthreads + ($pending < $opts(-handles) % $nthreads)}]
+        thread::send -async $tid [list soak $paths $n $opts(-type) $opts(-write) \
+            $opts(-rate) $opts(-channels)] ::result($tid)
+        incr pending
+    }
+    while {$pending} {
+        vwait ::result
+        incr pending -1
+    }
+    set elapsed [expr {([clock microseconds] - $start) / 1e6}]
+    set after [sndfile::memory]
+
+    set frames 0
+    set bytes 0
+    set errors {}
+    foreach tid $tids {
+        set res $::result($tid)
+        if {[catch {
+            incr frames [dict get $res frames]
+            incr bytes [dict get $res bytes]
+            lappend errors {*}[dict get $res errors]
+        }]} {
+            # The worker failed, the result is its error message
+            lappend errors $res
+        }
+        unset ::result($tid)
+        thread::release $tid
+        thread::join $tid
+    }
+
+    # Everything is closed and every interpreter is gone
+    set leaked [sndfile::memory]
+    set ok [expr {[dict get $leaked handles] == 0 && [dict get $leaked buffers] == 0 &&
+                  [dict get $leaked used] == 0 && [llength $errors] == 0}]
+
+    return [list rate [expr {$frames / $elapsed / 1e6}] \
+        perhandle [expr {$bytes / $opts(-handles)}] \
+        allocs [expr {[dict get $after allocs] - [dict get $before allocs]}] \
+        reuses [expr {[dict get $after reuses] - [dict get $before reuses]}] \
+        failures [expr {[dict get $after failures] - [dict get $before failures]}] \
+        peak [dict get $after peak] pooled [dict get $leaked pooled] \
+        ok $ok errors $errors]
+}
+
+
+#-------------------------------------------------------------------------------
+
+set paths [makeFiles]
+puts "handles $opts(-handles), $opts(-files) files of $opts(-seconds) s,\
+      $opts(-rate) Hz, $opts(-channels) channels, read_$opts(-type),\
+      write [expr {$opts(-write) ? "on" : "off"}]"
+puts [format "%7s %10s %7s %12s %8s %8s %8s %12s %12s %5s" \
+    threads Mframes/s scaling bytes/handle allocs reuses failures peak pooled leak]
+
+set status 0
+set base {}
+foreach nthreads $opts(-threads) {
+    set r [round $paths $nthreads]
+    if {$base eq ""} {
+        set base [dict get $r rate]
+    }
+    puts [format "%7d %10.2f %7.2f %12d %8d %8d %8d %12d %12d %5s" \
+        $nthreads [dict get $r rate] [expr {[dict get $r rate] / $base}] \
+        [dict get $r perhandle] [dict get $r allocs] [dict get $r reuses] \
+        [dict get $r failures] [dict get $r peak] [dict get $r pooled] \
+        [expr {[dict get $r ok] ? "ok" : "FAIL"}]]
+    foreach error [lrange [dict get $r errors] 0 9] {
+        puts "    $error"
+    }
+    if {![dict get $r ok]} {
+        set status 1
+    }
+}
+
+file delete -force $opts(-dir)
+exit $status